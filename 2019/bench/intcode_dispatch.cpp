@@ -0,0 +1,47 @@
+#include <chrono>
+#include <iostream>
+
+#include "intcode.h"
+#include "utils.h"
+
+
+// Number of times to run the program with each dispatch engine
+constexpr int REPETITIONS = 20;
+// Input which puts the day09 BOOST program in sensor boost mode,
+// the longest-running Intcode program in this repo
+constexpr intcode_type BOOST_INPUT = 2;
+
+
+double time_boost(const program_type &program,
+                  IntcodeMachine::Dispatch dispatch,
+                  intcode_type &result) {
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < REPETITIONS; ++i) {
+        IntcodeMachine machine(program);
+        machine.set_dispatch(dispatch);
+        machine.feed(BOOST_INPUT);
+        machine.run_until_input_needed();
+        result = machine.take_output();
+    }
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / REPETITIONS;
+}
+
+
+int main(int argc, char **argv) {
+    auto program = load_intcode_program(input_filename(argc, argv));
+
+    intcode_type switch_result = -1, threaded_result = -1;
+    auto switch_ms = time_boost(
+        program, IntcodeMachine::Dispatch::SWITCH, switch_result);
+    auto threaded_ms = time_boost(
+        program, IntcodeMachine::Dispatch::THREADED, threaded_result);
+
+    std::cout << "Switch dispatch:   " << switch_ms << " ms per run";
+    std::cout << " (output " << switch_result << ")" << std::endl;
+    std::cout << "Threaded dispatch: " << threaded_ms << " ms per run";
+    std::cout << " (output " << threaded_result << ")" << std::endl;
+    std::cout << "Speedup: " << switch_ms / threaded_ms << "x" << std::endl;
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "intcode.h"
+#include "utils.h"
+
+
+// The day23 network, repeated as many times as needed
+constexpr size_t CLUSTER_SIZE = 50;
+constexpr intcode_type NAT_ADDRESS = 255;
+constexpr size_t PACKET_SIZE = 3;
+constexpr size_t DEFAULT_MACHINES = 10'000;
+
+
+struct NAT {
+    std::mutex mutex;
+    intcode_type first_y = -1;
+    intcode_type last_x = -1, last_y = -1;
+    intcode_type previous_y_released = -1;
+    bool received_packet = false;
+    bool finished = false;
+};
+
+
+struct RunResult {
+    double ms;
+    std::uint64_t slices, steals;
+    std::vector<intcode_type> first_ys, repeated_ys;
+};
+
+
+// Run independent copies of the day23 network side by side on one
+// executor, until every copy's NAT releases the same Y value twice
+RunResult run_clusters(const program_type &program, size_t num_clusters, size_t num_workers) {
+    auto start = std::chrono::steady_clock::now();
+    IntcodeExecutor executor(num_workers);
+    for (size_t id = 0; id < num_clusters * CLUSTER_SIZE; ++id) {
+        IntcodeMachine nic(program);
+        nic.set_default_input(-1);
+        nic.feed(static_cast<intcode_type>(id % CLUSTER_SIZE));
+        executor.add_machine(std::move(nic));
+    }
+    std::vector<NAT> nats(num_clusters);
+    // Only touched while running the NIC they belong to
+    std::vector<std::vector<intcode_type> > partial_packets(executor.size());
+
+    auto handler = [&](size_t id, const std::vector<intcode_type> &outputs) -> void {
+        auto cluster = id / CLUSTER_SIZE;
+        auto &partial = partial_packets[id];
+        for (auto value: outputs) {
+            partial.push_back(value);
+            if (partial.size() < PACKET_SIZE) {
+                continue;
+            }
+            auto dest = partial[0];
+            if (dest == NAT_ADDRESS) {
+                auto &nat = nats[cluster];
+                std::lock_guard<std::mutex> guard(nat.mutex);
+                if (!nat.received_packet) {
+                    nat.first_y = partial[2];
+                }
+                nat.last_x = partial[1];
+                nat.last_y = partial[2];
+                nat.received_packet = true;
+            } else if (dest >= 0 && dest < static_cast<intcode_type>(CLUSTER_SIZE)) {
+                executor.send(cluster * CLUSTER_SIZE + dest, {partial[1], partial[2]});
+            } else {
+                throw std::runtime_error("Invalid destination address");
+            }
+            partial.clear();
+        }
+    };
+
+    size_t num_finished = 0;
+    while (num_finished < num_clusters) {
+        executor.run(handler);
+        // Every NIC is parked, so every network is idle
+        auto released = false;
+        for (size_t cluster = 0; cluster < num_clusters; ++cluster) {
+            auto &nat = nats[cluster];
+            if (nat.finished || !nat.received_packet) {
+                continue;
+            }
+            if (nat.last_y == nat.previous_y_released) {
+                nat.finished = true;
+                ++num_finished;
+                continue;
+            }
+            nat.previous_y_released = nat.last_y;
+            executor.send(cluster * CLUSTER_SIZE, {nat.last_x, nat.last_y});
+            released = true;
+        }
+        if (!released && num_finished < num_clusters) {
+            throw std::runtime_error("Network stalled before every NAT finished");
+        }
+    }
+
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    RunResult result{elapsed.count(), executor.slices_run(), executor.steals_made(), {}, {}};
+    for (auto &nat: nats) {
+        result.first_ys.push_back(nat.first_y);
+        result.repeated_ys.push_back(nat.last_y);
+    }
+    return result;
+}
+
+
+// Usage: intcode_executor.exe day23/input23.txt [num_machines [num_workers]]
+// Compares one worker thread against num_workers, which defaults
+// to one per hardware thread
+int main(int argc, char **argv) {
+    // input_filename() only expects the program's filename
+    auto program = load_intcode_program(input_filename(std::min(argc, 2), argv));
+    auto num_machines = argc > 2 ? std::stoul(argv[2]) : DEFAULT_MACHINES;
+    auto num_clusters = std::max(num_machines / CLUSTER_SIZE, size_t{1});
+    size_t max_workers = argc > 3 ? std::stoul(argv[3])
+                                  : std::max(1u, std::thread::hardware_concurrency());
+
+    std::cout << "Machines: " << num_clusters * CLUSTER_SIZE;
+    std::cout << " in " << num_clusters << " networks" << std::endl;
+    std::vector<size_t> worker_counts{1};
+    if (max_workers > 1) {
+        worker_counts.push_back(max_workers);
+    }
+    for (auto num_workers: worker_counts) {
+        auto result = run_clusters(program, num_clusters, num_workers);
+        // Every copy of the network should reach the same answers
+        if (std::count(result.first_ys.begin(), result.first_ys.end(), result.first_ys[0])
+                    != static_cast<long>(num_clusters)
+                || std::count(result.repeated_ys.begin(), result.repeated_ys.end(),
+                              result.repeated_ys[0]) != static_cast<long>(num_clusters)) {
+            std::cerr << "Networks disagree" << std::endl;
+            return 1;
+        }
+        std::cout << num_workers << " worker(s): " << result.ms << " ms, ";
+        std::cout << result.slices << " slices, " << result.steals << " steals";
+        std::cout << " (answers " << result.first_ys[0] << ", ";
+        std::cout << result.repeated_ys[0] << ")" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "intcode.h"
+#include "utils.h"
+
+
+// Number of times to run the program with fusion on and off
+constexpr int REPETITIONS = 20;
+
+
+struct RunStats {
+    std::uint64_t dispatches = 0;
+    std::vector<intcode_type> outputs;
+    double ms = 0;
+};
+
+
+// Run until the program halts or runs out of input
+RunStats run(const program_type &program,
+             const std::vector<intcode_type> &inputs,
+             bool fusion) {
+    RunStats stats;
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < REPETITIONS; ++i) {
+        IntcodeMachine machine(program);
+        machine.set_dispatch(IntcodeMachine::Dispatch::THREADED);
+        machine.set_fusion(fusion);
+        for (auto value: inputs) {
+            machine.feed(value);
+        }
+        machine.run_until_input_needed();
+        stats.dispatches = machine.dispatch_count();
+        stats.outputs = machine.take_outputs();
+    }
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    stats.ms = elapsed.count() / REPETITIONS;
+    return stats;
+}
+
+
+// Usage: intcode_fusion.exe program.txt [input...]
+// Numeric inputs are fed as is. Anything else is fed
+// as a line of ASCII text, for interactive programs.
+int main(int argc, char **argv) {
+    // input_filename() only expects the program's filename
+    auto program = load_intcode_program(input_filename(std::min(argc, 2), argv));
+    std::vector<intcode_type> inputs;
+    for (auto i = 2; i < argc; ++i) {
+        std::string arg(argv[i]);
+        try {
+            size_t length = 0;
+            auto value = std::stoll(arg, &length);
+            if (length == arg.size()) {
+                inputs.push_back(value);
+                continue;
+            }
+        } catch (const std::invalid_argument &) {}
+        for (auto c: arg) {
+            inputs.push_back(c);
+        }
+        inputs.push_back('\n');
+    }
+
+    auto plain = run(program, inputs, false);
+    auto fused = run(program, inputs, true);
+    if (plain.outputs != fused.outputs) {
+        std::cerr << "Fusion changed the program's output" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Without fusion: " << plain.dispatches << " dispatches, ";
+    std::cout << plain.ms << " ms per run" << std::endl;
+    std::cout << "With fusion:    " << fused.dispatches << " dispatches, ";
+    std::cout << fused.ms << " ms per run" << std::endl;
+    if (plain.dispatches > 0) {
+        std::cout << "Dispatches removed: ";
+        std::cout << 100.0 * (plain.dispatches - fused.dispatches) / plain.dispatches;
+        std::cout << "%" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "intcode.h"
+#include "utils.h"
+
+
+// Number of times to load each program each way
+constexpr int REPETITIONS = 200;
+// Size of the large program made by repeating the given one,
+// to show how loading scales
+constexpr size_t LARGE_CELLS = 1 << 20;
+
+
+template <typename Func>
+double time_ms(Func func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+
+// Write program as text and as an image next to base_filename, then
+// time loading each with load_intcode_program()
+void compare_loads(const std::string &label, const program_type &program,
+                   size_t num_cells, const std::string &base_filename) {
+    auto text_filename = base_filename + ".bench.txt";
+    auto image_filename = base_filename + ".bench.img";
+    {
+        std::ofstream text_stream(text_filename);
+        for (size_t address = 0; address < num_cells; ++address) {
+            text_stream << (address > 0 ? "," : "") << program.read(address);
+        }
+        text_stream << '\n';
+        std::ofstream image_stream(image_filename, std::ios::binary);
+        save_intcode_image(program, num_cells, image_stream);
+    }
+
+    auto text_ms = time_ms([&]() -> void {
+        for (auto i = 0; i < REPETITIONS; ++i) {
+            load_intcode_program(text_filename);
+        }
+    });
+    auto image_ms = time_ms([&]() -> void {
+        for (auto i = 0; i < REPETITIONS; ++i) {
+            load_intcode_program(image_filename);
+        }
+    });
+    std::remove(text_filename.c_str());
+    std::remove(image_filename.c_str());
+
+    std::cout << label << ": " << num_cells << " cells" << std::endl;
+    std::cout << "  Text:    " << text_ms / REPETITIONS << " ms per load" << std::endl;
+    std::cout << "  Image:   " << image_ms / REPETITIONS << " ms per load" << std::endl;
+    std::cout << "  Speedup: " << text_ms / image_ms << "x" << std::endl;
+}
+
+
+// Compares loading a program from text against mapping a binary image of
+// it, both for the program itself and for a large program made by
+// repeating it. Then checks that the program gives the same result when
+// run with input 1 from either, using the image's decoded instructions.
+//
+// Usage: intcode_image.exe program.txt
+int main(int argc, char **argv) {
+    std::string filename = input_filename(argc, argv);
+    auto program = load_intcode_program(filename);
+    auto num_cells = program.size();
+    while (num_cells > 0 && program.read(num_cells - 1) == 0) {
+        --num_cells;
+    }
+    if (num_cells == 0) {
+        std::cerr << "Program is empty" << std::endl;
+        return 1;
+    }
+    compare_loads("Program", program, num_cells, filename);
+
+    program_type large_program;
+    for (size_t address = 0; address < LARGE_CELLS; ++address) {
+        large_program[static_cast<intcode_type>(address)] = program.read(address % num_cells);
+    }
+    compare_loads("Large", large_program, LARGE_CELLS, filename);
+
+    auto image_filename = filename + ".img";
+    {
+        std::ofstream output_stream(image_filename, std::ios::binary);
+        save_intcode_image(program, num_cells, output_stream);
+    }
+    IntcodeMachine from_text(program);
+    IntcodeMachine from_image(load_intcode_image(image_filename));
+    std::remove(image_filename.c_str());
+    for (auto machine: {&from_text, &from_image}) {
+        machine->feed(1);
+        machine->run_until_input_needed();
+    }
+    if (from_text.take_outputs() != from_image.take_outputs()) {
+        std::cerr << "Image gave different outputs" << std::endl;
+        return 1;
+    }
+    return 0;
+}
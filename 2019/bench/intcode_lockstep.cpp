@@ -0,0 +1,53 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "intcode.h"
+#include "utils.h"
+
+
+// Side of the square of points probed, as in day19 part 1
+constexpr intcode_type SCAN_SIZE = 100;
+
+
+template <typename Func>
+double time_ms(Func func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+
+// Compares running the day19 drone program once per point
+// with independent forks against running forks in lockstep
+int main(int argc, char **argv) {
+    IntcodeMachine start(load_intcode_program(input_filename(argc, argv)));
+    start.run_until_input_needed();
+
+    std::vector<std::vector<intcode_type> > inputs;
+    for (intcode_type x = 0; x < SCAN_SIZE; ++x) {
+        for (intcode_type y = 0; y < SCAN_SIZE; ++y) {
+            inputs.push_back({x, y});
+        }
+    }
+
+    std::vector<std::vector<intcode_type> > scalar_outputs, lockstep_outputs;
+    auto scalar_ms = time_ms([&]() -> void {
+        scalar_outputs = run_intcode_batch(start, inputs);
+    });
+    auto lockstep_ms = time_ms([&]() -> void {
+        lockstep_outputs = run_intcode_lockstep(start, inputs);
+    });
+    if (scalar_outputs != lockstep_outputs) {
+        std::cerr << "Lockstep outputs don't match" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Probes:   " << inputs.size() << std::endl;
+    std::cout << "Scalar:   " << scalar_ms << " ms" << std::endl;
+    std::cout << "Lockstep: " << lockstep_ms << " ms" << std::endl;
+    std::cout << "Speedup: " << scalar_ms / lockstep_ms << "x" << std::endl;
+    return 0;
+}
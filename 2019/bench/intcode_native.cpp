@@ -0,0 +1,48 @@
+#include <chrono>
+#include <iostream>
+
+#include "intcode.h"
+#include "utils.h"
+
+
+// Generated from day09/input09.txt by tools/intcode_to_cpp
+extern const IntcodeMachine::NativeProgram native_day09;
+
+// Number of times to run the program with and without native code
+constexpr int REPETITIONS = 20;
+// Input which puts the day09 BOOST program in sensor boost mode,
+// the longest-running Intcode program in this repo
+constexpr intcode_type BOOST_INPUT = 2;
+
+
+double time_boost(const program_type &program, bool native, intcode_type &result) {
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < REPETITIONS; ++i) {
+        IntcodeMachine machine(program);
+        if (native && !machine.set_native_program(&native_day09)) {
+            throw std::runtime_error("Program doesn't match the compiled code");
+        }
+        machine.feed(BOOST_INPUT);
+        machine.run_until_input_needed();
+        result = machine.take_output();
+    }
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / REPETITIONS;
+}
+
+
+int main(int argc, char **argv) {
+    auto program = load_intcode_program(input_filename(argc, argv));
+
+    intcode_type interpreted_result = -1, native_result = -1;
+    auto interpreted_ms = time_boost(program, false, interpreted_result);
+    auto native_ms = time_boost(program, true, native_result);
+
+    std::cout << "Interpreted: " << interpreted_ms << " ms per run";
+    std::cout << " (output " << interpreted_result << ")" << std::endl;
+    std::cout << "Native:      " << native_ms << " ms per run";
+    std::cout << " (output " << native_result << ")" << std::endl;
+    std::cout << "Speedup: " << interpreted_ms / native_ms << "x" << std::endl;
+    return 0;
+}
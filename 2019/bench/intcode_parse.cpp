@@ -0,0 +1,83 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "intcode.h"
+
+
+// Number of cells in the synthetic program
+constexpr size_t NUM_CELLS = 4'000'000;
+
+
+template <typename Func>
+double time_ms(Func func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+
+// The parser load_intcode_program() used to have
+program_type parse_with_stoll(std::istream &input_stream) {
+    program_type program;
+    std::string num_str;
+    intcode_type address = 0;
+    while (std::getline(input_stream, num_str, ',')) {
+        program[address] = std::stoll(num_str);
+        ++address;
+    }
+    return program;
+}
+
+
+// A program-like mix of opcodes, small addresses and occasional large
+// or negative constants
+std::string make_program_text(size_t num_cells) {
+    std::mt19937_64 generator(2019);
+    std::uniform_int_distribution<int> kind(0, 9);
+    std::uniform_int_distribution<intcode_type> small(0, 2000);
+    std::uniform_int_distribution<intcode_type> large(-1'000'000'000'000, 1'000'000'000'000);
+    std::ostringstream text;
+    for (size_t i = 0; i < num_cells; ++i) {
+        if (i > 0) {
+            text << ',';
+        }
+        text << (kind(generator) == 0 ? large(generator) : small(generator));
+    }
+    text << '\n';
+    return text.str();
+}
+
+
+// Compares parsing a large synthetic program with getline() and stoll()
+// against parsing it in place
+int main() {
+    auto text = make_program_text(NUM_CELLS);
+    auto megabytes = text.size() / 1e6;
+
+    program_type old_program, new_program;
+    auto stoll_ms = time_ms([&]() -> void {
+        std::istringstream input_stream(text);
+        old_program = parse_with_stoll(input_stream);
+    });
+    auto in_place_ms = time_ms([&]() -> void {
+        new_program = parse_intcode_program(text.data(), text.size());
+    });
+    for (size_t address = 0; address < NUM_CELLS; ++address) {
+        auto signed_address = static_cast<intcode_type>(address);
+        if (old_program.read(signed_address) != new_program.read(signed_address)) {
+            std::cerr << "Parsers disagree at address " << address << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "Program:  " << megabytes << " MB, " << NUM_CELLS << " cells" << std::endl;
+    std::cout << "stoll:    " << megabytes / (stoll_ms / 1000) << " MB/s" << std::endl;
+    std::cout << "In place: " << megabytes / (in_place_ms / 1000) << " MB/s" << std::endl;
+    std::cout << "Speedup: " << stoll_ms / in_place_ms << "x" << std::endl;
+    return 0;
+}
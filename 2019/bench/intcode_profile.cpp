@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "intcode.h"
+#include "utils.h"
+
+
+// Number of times to run the program with each kind of callback
+constexpr int REPETITIONS = 20;
+
+
+template <typename Func>
+double time_ms(Func func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+
+// Usage: intcode_profile.exe program.txt [input...]
+// Inputs are given as for intcode_fusion.exe. Times the program with
+// std::function callbacks, with lambdas passed straight to the templated
+// run_intcode_program() and with profiling, then prints the profile.
+int main(int argc, char **argv) {
+    // input_filename() only expects the program's filename
+    auto program = load_intcode_program(input_filename(std::min(argc, 2), argv));
+    std::vector<intcode_type> inputs;
+    for (auto i = 2; i < argc; ++i) {
+        std::string arg(argv[i]);
+        try {
+            size_t length = 0;
+            auto value = std::stoll(arg, &length);
+            if (length == arg.size()) {
+                inputs.push_back(value);
+                continue;
+            }
+        } catch (const std::invalid_argument &) {}
+        for (auto c: arg) {
+            inputs.push_back(c);
+        }
+        inputs.push_back('\n');
+    }
+
+    size_t next_input = 0;
+    std::vector<intcode_type> outputs;
+    StopToken stop_token;
+    auto input = [&]() -> intcode_type {
+        if (next_input == inputs.size()) {
+            stop_token.request_stop();
+            return 0;
+        }
+        return inputs[next_input++];
+    };
+    auto output = [&](intcode_type value) -> void {
+        outputs.push_back(value);
+    };
+    auto reset = [&]() -> void {
+        next_input = 0;
+        outputs.clear();
+        stop_token = StopToken();
+    };
+
+    std::vector<intcode_type> function_outputs;
+    auto function_ms = time_ms([&]() -> void {
+        for (auto i = 0; i < REPETITIONS; ++i) {
+            reset();
+            std::function<intcode_type()> input_function(input);
+            std::function<void(intcode_type)> output_function(output);
+            run_intcode_program(program, input_function, output_function, stop_token);
+        }
+    });
+    function_outputs = outputs;
+    auto template_ms = time_ms([&]() -> void {
+        for (auto i = 0; i < REPETITIONS; ++i) {
+            reset();
+            run_intcode_program(program, input, output, stop_token);
+        }
+    });
+    if (outputs != function_outputs) {
+        std::cerr << "Callback types gave different outputs" << std::endl;
+        return 1;
+    }
+
+    // Profiled runs can't be stopped early, so hand over the inputs up front
+    IntcodeProfile profile;
+    IntcodeMachine machine(program);
+    machine.set_profile(&profile);
+    for (auto value: inputs) {
+        machine.feed(value);
+    }
+    auto profiled_ms = time_ms([&]() -> void {
+        machine.run_until_input_needed();
+    });
+    if (machine.take_outputs() != function_outputs) {
+        std::cerr << "Profiling changed the program's output" << std::endl;
+        return 1;
+    }
+
+    std::cout << "std::function: " << function_ms / REPETITIONS << " ms per run" << std::endl;
+    std::cout << "Template:      " << template_ms / REPETITIONS << " ms per run" << std::endl;
+    std::cout << "Profiled:      " << profiled_ms << " ms" << std::endl;
+    std::cout << std::endl;
+    profile.report(std::cout);
+    return 0;
+}
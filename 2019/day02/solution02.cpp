@@ -4,31 +4,42 @@
 #include "utils.h"
 
 
+// Run a fork of the unmodified program with the given noun and verb
+intcode_type run_with_inputs(const IntcodeMachine &initial,
+                             intcode_type noun, intcode_type verb) {
+    auto machine = initial.fork();
+    machine.write(1, noun);
+    machine.write(2, verb);
+    machine.run_until_input_needed();
+    return machine.read(0);
+}
+
+
 int main(int argc, char **argv) {
-    auto input_stream = open_input_file(argc, argv);
-    auto program = load_intcode_program(input_stream);
+    IntcodeMachine initial(load_intcode_program(input_filename(argc, argv)));
 
     // For part 1, set noun to 12 and verb to 2
-    program[1] = 12;
-    program[2] = 2;
-    auto part_1_result = run_intcode_program(program);
+    auto part_1_result = run_with_inputs(initial, 12, 2);
 
-    // For part 2, loop over all possible nouns and verbs
-    // until the desired output is found
+    // For part 2, loop over all possible nouns until the desired output
+    // is found, trying every verb at once in lockstep. The program has
+    // no jumps, so the lanes never diverge.
     intcode_type part_2_result = -1;
     intcode_type desired_output = 19690720;
-    for (auto noun = 0; noun < 100; ++noun) {
-        for (auto verb = 0; verb < 100; ++verb) {
-            program[1] = noun;
-            program[2] = verb;
-            if (run_intcode_program(program) == desired_output) {
+    constexpr intcode_type NUM_VERBS = 100;
+    for (auto noun = 0; noun < 100 && part_2_result < 0; ++noun) {
+        IntcodeBatch batch(initial, NUM_VERBS);
+        for (auto verb = 0; verb < NUM_VERBS; ++verb) {
+            batch.write(verb, 1, noun);
+            batch.write(verb, 2, verb);
+        }
+        batch.run();
+        for (auto verb = 0; verb < NUM_VERBS; ++verb) {
+            if (batch.read(verb, 0) == desired_output) {
                 part_2_result = 100 * noun + verb;
                 break;
             }
         }
-        if (part_2_result >= 0) {
-            break;
-        }
     }
 
     std::cout << "PART 1" << std::endl;
@@ -1,8 +1,7 @@
 #include <algorithm>
 #include <array>
 #include <iostream>
-#include <limits>
-#include <thread>
+#include <stdexcept>
 #include <vector>
 
 #include "intcode.h"
@@ -12,78 +11,67 @@
 using phase_settings_type = std::array<intcode_type, 5>;
 
 
-// This is very slow. Maybe running the intcode program is taking a long time?
-// Maybe all the thread-switching is adding a lot of overhead?
-// It also doesn't appear to be totally deterministic, which is concerning.
-intcode_type simulate_phase_settings(program_type program,
+// Run the amplifiers round-robin on a single thread,
+// handing each amplifier's output directly to the next one's input
+intcode_type simulate_phase_settings(const program_type &program,
                                      const phase_settings_type &phase_settings) {
-    MultiQueue<intcode_type> mq;
-    std::vector<std::thread> threads;
-    for (size_t i = 0; i < phase_settings.size(); ++i) {
-        mq.push_queue(i, phase_settings[i]);
-
-        auto get_input = [&mq, i]() -> intcode_type {
-            return mq.pop_queue_blocking(i);
-        };
-
-        auto size = phase_settings.size();
-        auto give_output = [&mq, i, size](intcode_type output) -> void {
-            mq.push_queue((i + 1) % size, output);
-        };
-
-        threads.emplace_back(
-            // Wrap run_intcode_program in lambda so overload resolution works
-            [program, get_input, give_output]() -> intcode_type {
-                return run_intcode_program(program, get_input, give_output);
-            });
+    std::vector<IntcodeMachine> amplifiers;
+    for (auto phase: phase_settings) {
+        amplifiers.emplace_back(program);
+        amplifiers.back().feed(phase);
     }
     // Set input signal of 0 to first thruster to start
-    mq.push_queue(0, 0);
-    // Wait for all threads to finish
-    for (auto& thd: threads) {
-        thd.join();
+    amplifiers.front().feed(0);
+
+    intcode_type last_signal = -1;
+    bool all_halted = false;
+    while (!all_halted) {
+        all_halted = true;
+        bool any_output = false;
+        for (size_t i = 0; i < amplifiers.size(); ++i) {
+            auto state = amplifiers[i].run_until_input_needed();
+            auto &next_amplifier = amplifiers[(i + 1) % amplifiers.size()];
+            for (auto signal: amplifiers[i].take_outputs()) {
+                next_amplifier.feed(signal);
+                any_output = true;
+                if (i == amplifiers.size() - 1) {
+                    last_signal = signal;
+                }
+            }
+            all_halted = all_halted && state == IntcodeMachine::State::HALTED;
+        }
+        if (!all_halted && !any_output) {
+            throw std::runtime_error("Amplifiers are deadlocked waiting for input");
+        }
     }
     // Return final output from last thruster
-    return mq.pop_queue_blocking(0);
+    return last_signal;
 }
 
 
-template <typename T>
-T factorial(T num) {
-    return (num == 0) ? 1 : num * factorial(num - 1);
+// Try every permutation of the given phase settings in parallel
+// and return the largest thruster signal
+intcode_type max_thruster_signal(const program_type &program,
+                                 phase_settings_type phase_settings) {
+    std::sort(phase_settings.begin(), phase_settings.end());
+    std::vector<phase_settings_type> permutations;
+    do {
+        permutations.push_back(phase_settings);
+    } while (std::next_permutation(phase_settings.begin(), phase_settings.end()));
+
+    std::vector<intcode_type> signals(permutations.size());
+    parallel_for(permutations.size(), [&](size_t i) -> void {
+        signals[i] = simulate_phase_settings(program, permutations[i]);
+    });
+    return *std::max_element(signals.begin(), signals.end());
 }
 
 
 int main(int argc, char **argv) {
-    auto input_stream = open_input_file(argc, argv);
-    auto program = load_intcode_program(input_stream);
-
-    phase_settings_type phase_settings{0, 1, 2, 3, 4};
-    auto part1_max = std::numeric_limits<intcode_type>::min();
-    auto iteration = 0;
-    do {
-        std::cout << "Calculating part 1: " << iteration;
-        std::cout << " / " << factorial(phase_settings.size()) << '\r';
-        std::flush(std::cout);
-        auto signal = simulate_phase_settings(program, phase_settings);
-        part1_max = std::max(part1_max, signal);
-        ++iteration;
-    } while (std::next_permutation(phase_settings.begin(), phase_settings.end()));
-    std::cout << std::endl;
-
-    phase_settings = phase_settings_type{5, 6, 7, 8, 9};
-    auto part2_max = std::numeric_limits<intcode_type>::min();
-    iteration = 0;
-    do {
-        std::cout << "Calculating part 2: " << iteration;
-        std::cout << " / " << factorial(phase_settings.size()) << '\r';
-        std::flush(std::cout);
-        auto signal = simulate_phase_settings(program, phase_settings);
-        part2_max = std::max(part2_max, signal);
-        ++iteration;
-    } while (std::next_permutation(phase_settings.begin(), phase_settings.end()));
-    std::cout << std::endl;
+    auto program = load_intcode_program(input_filename(argc, argv));
 
+    auto part1_max = max_thruster_signal(program, phase_settings_type{0, 1, 2, 3, 4});
+    auto part2_max = max_thruster_signal(program, phase_settings_type{5, 6, 7, 8, 9});
 
     std::cout << "PART 1" << std::endl;
     std::cout << "Max thruster signal: " << part1_max << std::endl;
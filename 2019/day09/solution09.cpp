@@ -6,8 +6,7 @@
 
 
 int main(int argc, char **argv) {
-    auto input_stream = open_input_file(argc, argv);
-    auto program = load_intcode_program(input_stream);
+    auto program = load_intcode_program(input_filename(argc, argv));
 
     std::cout << "PART 1" << std::endl;
     std::cout << "BOOST program output for input 1: ";
@@ -140,8 +140,7 @@ void draw_panels(const panels_type &panels) {
 
 
 int main(int argc, char **argv) {
-    auto input_stream = open_input_file(argc, argv);
-    auto program = load_intcode_program(input_stream);
+    auto program = load_intcode_program(input_filename(argc, argv));
 
     panels_type panels;
     Robot robo;
@@ -27,8 +27,7 @@ using tiles_type = std::map<coord_type, Tile>;
 
 
 int main(int argc, char **argv) {
-    auto input_stream = open_input_file(argc, argv);
-    auto program = load_intcode_program(input_stream);
+    auto program = load_intcode_program(input_filename(argc, argv));
 
     tiles_type tiles;
     auto intcode_input = [&tiles]() -> intcode_type {
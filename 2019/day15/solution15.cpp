@@ -288,8 +288,7 @@ void update_maze(grid_type &grid, Droid &droid,
 
 
 int main(int argc, char **argv) {
-    auto input_stream = open_input_file(argc, argv);
-    auto program = load_intcode_program(input_stream);
+    auto program = load_intcode_program(input_filename(argc, argv));
 
     // Create grid full of unknown Nodes
     grid_type grid;
@@ -435,20 +435,16 @@ std::vector<std::string> compress(const std::vector<Move> &moves_vec) {
 
 
 int main(int argc, char **argv) {
-    auto input_stream = open_input_file(argc, argv);
-    auto program = load_intcode_program(input_stream);
+    auto program = load_intcode_program(input_filename(argc, argv));
 
     grid_type grid;
     size_t row_index = 0;
     size_t column_index = 0;
     Robot robo;
 
-    auto part1_input = []() -> intcode_type {
-        return 0;
-    };
-
-    auto part1_output = [&](intcode_type output) -> void {
-        auto output_char = static_cast<char>(output);
+    // Read grid and calculate alignment parameters
+    AsciiChannel camera{IntcodeMachine(program)};
+    for (auto output_char: camera.read_until_prompt()) {
         if (output_char == '\n') {
             column_index = 0;
             ++row_index;
@@ -456,10 +452,7 @@ int main(int argc, char **argv) {
             add_grid_cell(grid, robo, output_char, row_index, column_index);
             ++column_index;
         }
-    };
-
-    // Read grid and calculate alignment parameters
-    run_intcode_program(program, part1_input, part1_output);
+    }
     draw_grid(grid, robo);
     auto align_param = calculate_alignment_params(grid);
 
@@ -471,24 +464,22 @@ int main(int argc, char **argv) {
         std::cout << s << std::endl;
     }
 
+    // Switch program mode
+    program[0] = 2;
+    AsciiChannel robot{IntcodeMachine(program)};
     // Send robot movement instructions
-    std::stringstream robot_input;
     for (size_t i = 0; i < movement_routines.size(); ++i) {
-        robot_input << movement_routines[i] << '\n';
+        robot.send_line(movement_routines[i]);
     }
     // Don't show video feed
-    robot_input << "n\n";
-    auto part2_input = [&robot_input]() -> intcode_type {
-        return static_cast<intcode_type>(robot_input.get());
-    };
-
-    intcode_type dust_collected;
-    auto part2_output = [&dust_collected](intcode_type output) -> void {
-        dust_collected = output;
-    };
-    // Switch program mode
-    program[0] = 2;
-    run_intcode_program(program, part2_input, part2_output);
+    robot.send_line("n");
+    robot.read_until_prompt();
+    // The amount of dust is too large to be a character
+    auto values = robot.take_values();
+    if (values.empty()) {
+        throw std::runtime_error("Robot didn't report how much dust it collected");
+    }
+    auto dust_collected = values.back();
 
     std::cout << "PART 1" << std::endl;
     std::cout << "Alignment paramter: " << align_param << std::endl;
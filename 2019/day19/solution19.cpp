@@ -1,8 +1,11 @@
 #include <algorithm>
 #include <array>
+#include <cstdlib>
 #include <iostream>
 #include <limits>
-#include <map>
+#include <optional>
+#include <stdexcept>
+#include <vector>
 
 #include "intcode.h"
 #include "utils.h"
@@ -14,87 +17,230 @@ enum class Status {
 };
 
 using coord_type = std::array<size_t, 2>;
-using grid_type = std::map<coord_type, Status>;
+// Results of the initial scan, indexed by y then x
+using grid_type = std::vector<std::vector<Status> >;
 constexpr size_t SCAN_SIZE = 50;
 constexpr size_t SHIP_SIZE = 100;
 
 
-Status get_droid_status(const program_type &program, coord_type coords) {
-    size_t index = 0;
-    Status result;
-    auto intcode_input = [&coords, &index]() -> intcode_type {
-        return coords[index++];
-    };
-    auto intcode_output = [&result](intcode_type output) -> void {
-        result = static_cast<Status>(output);
-    };
-    run_intcode_program(program, intcode_input, intcode_output);
-    return result;
+Status get_droid_status(IntcodeProbeCache &cache, coord_type coords) {
+    return static_cast<Status>(cache.probe({static_cast<intcode_type>(coords[0]),
+                                            static_cast<intcode_type>(coords[1])}).at(0));
 }
 
 
-Status get_from_grid(grid_type &grid, coord_type coords,
-                     const program_type &program) {
-    if (grid.find(coords) == grid.end()) {
-        grid[coords] = get_droid_status(program, coords);
+// Probe every point in the size x size square at the origin at once
+grid_type scan_grid(IntcodeProbeCache &cache, size_t size) {
+    std::vector<std::vector<intcode_type> > inputs;
+    for (size_t y = 0; y < size; ++y) {
+        for (size_t x = 0; x < size; ++x) {
+            inputs.push_back({static_cast<intcode_type>(x),
+                              static_cast<intcode_type>(y)});
+        }
+    }
+    auto outputs = cache.probe_all(inputs);
+    grid_type grid(size, std::vector<Status>(size));
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        grid[i / size][i % size] = static_cast<Status>(outputs[i].at(0));
     }
-    return grid.at(coords);
+    return grid;
 }
 
 
 void draw_grid(const grid_type &grid) {
     for (size_t i = 0; i < SCAN_SIZE; ++i) {
         for (size_t j = 0; j < SCAN_SIZE; ++j) {
-            std::cout << (grid.at(coord_type{j, i}) == Status::PULLED ? '#' : '.');
+            std::cout << (grid[i][j] == Status::PULLED ? '#' : '.');
         }
         std::cout << std::endl;
     }
 }
 
 
-int main(int argc, char **argv) {
-    auto input_stream = open_input_file(argc, argv);
-    auto program = load_intcode_program(input_stream);
+// A pulled point far from the origin, taken from the middle of the beam
+// in the lowest row of the scan. Since the beam is a cone, the ray from
+// the origin through this point stays inside it. Row 0 is never used:
+// the origin is always pulled, but gives the ray no direction.
+coord_type find_seed(const grid_type &grid) {
+    for (auto y = SCAN_SIZE; y-- > 1;) {
+        size_t first = SCAN_SIZE, last = 0;
+        for (size_t x = 0; x < SCAN_SIZE; ++x) {
+            if (grid[y][x] == Status::PULLED) {
+                first = std::min(first, x);
+                last = x;
+            }
+        }
+        if (first <= last) {
+            return coord_type{(first + last) / 2, y};
+        }
+    }
+    throw std::runtime_error("No part of the beam found in the scan beyond the origin");
+}
 
-    grid_type grid;
-    size_t affected = 0, part1_answer = 0, part2_answer = 0;
 
-    for (size_t x = 0; x < SCAN_SIZE; ++x) {
-        for (size_t y = 0; y < SCAN_SIZE; ++y) {
-            if (get_from_grid(grid, coord_type{x, y}, program) == Status::PULLED) {
-                ++affected;
-            }
-            if (x == SCAN_SIZE - 1 && y == SCAN_SIZE - 1) {
-                part1_answer = affected;
-            }
+// Ends of the beam in row y, or nothing if the row looks empty.
+// Each row of the beam is contiguous, so both ends can be found by
+// binary search out from a point along the seed's ray. The right end
+// is first bracketed by doubling the step size.
+std::optional<std::array<size_t, 2> > find_row_edges(
+        IntcodeProbeCache &cache, coord_type seed, size_t y) {
+    auto inside = (seed[0] * y + seed[1] / 2) / seed[1];
+    if (get_droid_status(cache, coord_type{inside, y}) != Status::PULLED) {
+        return std::nullopt;
+    }
+
+    // First pulled point in [0, inside]
+    size_t low = 0, high = inside;
+    while (low < high) {
+        auto middle = (low + high) / 2;
+        if (get_droid_status(cache, coord_type{middle, y}) == Status::PULLED) {
+            high = middle;
+        } else {
+            low = middle + 1;
         }
     }
-    draw_grid(grid);
+    auto left = low;
+
+    // Last pulled point in [inside, inside + step)
+    size_t step = 1;
+    while (get_droid_status(cache, coord_type{inside + step, y}) == Status::PULLED) {
+        step *= 2;
+    }
+    low = inside + step / 2;
+    high = inside + step - 1;
+    while (low < high) {
+        auto middle = (low + high + 1) / 2;
+        if (get_droid_status(cache, coord_type{middle, y}) == Status::PULLED) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return std::array<size_t, 2>{left, low};
+}
+
+
+// Ends of the beam in row y of the scan, or nothing if the row is empty.
+// If the beam runs off the edge of the scan, the rest of it is probed.
+std::optional<std::array<size_t, 2> > scanned_row_edges(
+        const grid_type &grid, IntcodeProbeCache &cache, size_t y) {
+    const auto &row = grid[y];
+    auto first = std::find(row.begin(), row.end(), Status::PULLED);
+    if (first == row.end()) {
+        return std::nullopt;
+    }
+    auto left = static_cast<size_t>(first - row.begin());
+    auto right = left;
+    while (get_droid_status(cache, coord_type{right + 1, y}) == Status::PULLED) {
+        ++right;
+    }
+    return std::array<size_t, 2>{left, right};
+}
 
-    // Walk along the outer edges of the beam
-    // FIXME: generalize the starting point, don't used hard-coded numbers
-    coord_type left_edge{13, 17}, right_edge{13, 17};
-    while (true) {
-        auto x_width = right_edge[0] - left_edge[0] + 1;
-        auto y_width = left_edge[1] - right_edge[1] + 1;
-        if (x_width >= SHIP_SIZE && y_width >= SHIP_SIZE) {
-            part2_answer = left_edge[0] * 10000 + right_edge[1];
-            break;
+
+// Each edge of the beam is a straight line from the origin rounded to
+// whole cells, so it's off from that line by less than one column. The
+// slack computed from two edges is therefore within this much of a linear
+// function of the row, which grows further from the origin.
+constexpr long long EDGE_ROUNDING = 2;
+
+
+// Closest point, encoded as 10000 * x + y, at which a square ship of the
+// given size fits entirely within the beam. The square's top right corner
+// must be in the beam's top row and its bottom left in the bottom row.
+//
+// Ships which fit in rows of the scan are found by checking each row in
+// turn. Beyond those, the beam has to behave like a cone: every row past
+// the scan is expected to contain part of it, or this throws.
+size_t find_ship_location(const grid_type &grid, IntcodeProbeCache &cache,
+                          size_t ship_size) {
+    auto seed = find_seed(grid);
+    auto row_edges = [&](size_t y) -> std::optional<std::array<size_t, 2> > {
+        if (y < SCAN_SIZE) {
+            return scanned_row_edges(grid, cache, y);
+        }
+        auto edges = find_row_edges(cache, seed, y);
+        if (!edges) {
+            throw std::runtime_error("Beam doesn't look like a cone");
         }
-        if (x_width < y_width) {
-            ++right_edge[1];
-            while (get_from_grid(grid, right_edge, program) == Status::PULLED) {
-                ++right_edge[0];
+        return edges;
+    };
+    // Number of columns to spare if the ship's top row is top,
+    // or nothing if one of its rows has no beam
+    auto slack = [&](size_t top) -> std::optional<long long> {
+        auto top_edges = row_edges(top);
+        auto bottom_edges = row_edges(top + ship_size - 1);
+        if (!top_edges || !bottom_edges) {
+            return std::nullopt;
+        }
+        return static_cast<long long>((*top_edges)[1] + 1)
+               - static_cast<long long>((*bottom_edges)[0] + ship_size);
+    };
+    auto fits = [&](size_t top) -> bool {
+        return slack(top).value_or(-1) >= 0;
+    };
+    auto location = [&](size_t top) -> size_t {
+        return (*row_edges(top + ship_size - 1))[0] * 10000 + top;
+    };
+
+    // Near the origin the beam is too thin and ragged to search, but
+    // those rows are already known
+    size_t first_unscanned = 0;
+    if (ship_size <= SCAN_SIZE) {
+        first_unscanned = SCAN_SIZE - ship_size + 1;
+        for (size_t top = 0; top < first_unscanned; ++top) {
+            if (fits(top)) {
+                return location(top);
             }
-            --right_edge[0];
+        }
+    }
+
+    // Since slack is within EDGE_ROUNDING of a growing function, every
+    // row after the first one that fits nearly fits too. So a binary
+    // search for the start of the rows that nearly fit ends at or before
+    // the first row that fits, and stepping forward from there finds it.
+    auto nearly_fits = [&](size_t top) -> bool {
+        auto result = slack(top);
+        return result && *result >= -EDGE_ROUNDING;
+    };
+    size_t low = first_unscanned, step = 1;
+    while (!nearly_fits(low + step - 1)) {
+        low += step;
+        step *= 2;
+    }
+    auto high = low + step - 1;
+    while (low < high) {
+        auto middle = (low + high) / 2;
+        if (nearly_fits(middle)) {
+            high = middle;
         } else {
-            ++left_edge[1];
-            while (get_from_grid(grid, left_edge, program) == Status::STATIONARY) {
-                ++left_edge[0];
-            }
+            low = middle + 1;
         }
     }
+    auto top = low;
+    while (!fits(top)) {
+        ++top;
+    }
+    return location(top);
+}
+
+
+// Probe results are saved to the file named by INTCODE_PROBE_CACHE, if set,
+// so later runs can skip the drone program entirely
+int main(int argc, char **argv) {
+    auto cache_filename = std::getenv("INTCODE_PROBE_CACHE");
+    IntcodeProbeCache cache(load_intcode_program(input_filename(argc, argv)),
+                            cache_filename ? cache_filename : "");
+
+    size_t part1_answer = 0, part2_answer = 0;
+
+    auto grid = scan_grid(cache, SCAN_SIZE);
+    for (const auto &row: grid) {
+        part1_answer += std::count(row.begin(), row.end(), Status::PULLED);
+    }
+    draw_grid(grid);
 
+    part2_answer = find_ship_location(grid, cache, SHIP_SIZE);
 
     std::cout << "PART 1" << std::endl;
     std::cout << "Number of affected points: " << part1_answer << std::endl;
@@ -1,6 +1,4 @@
-#include <functional>
 #include <iostream>
-#include <limits>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -73,35 +71,26 @@ std::stringstream instructions_to_stream(
 }
 
 
-std::function<void(intcode_type)> print_intcode_output() {
-    auto intcode_output = [](intcode_type output) -> void {
-        if (output > std::numeric_limits<signed char>::max()) {
-            std::cout << output << std::endl;
-        } else {
-            std::cout << static_cast<char>(output);
-        }
-    };
-    return intcode_output;
-}
-
-
 void run_springdroid_program(const std::vector<Instruction> &instructions,
                              const program_type &program,
                              bool part1 = true) {
-    auto instructions_string = instructions_to_stream(
-        instructions, part1).str();
-    size_t string_index = 0;
-    auto intcode_input = [&]() -> intcode_type {
-        auto result = instructions_string[string_index++];
-        return static_cast<intcode_type>(result);
-    };
-    run_intcode_program(program, intcode_input, print_intcode_output());
+    AsciiChannel channel{IntcodeMachine(program)};
+    std::cout << channel.read_until_prompt();
+    std::string line;
+    auto instructions_stream = instructions_to_stream(instructions, part1);
+    while (std::getline(instructions_stream, line)) {
+        channel.send_line(line);
+    }
+    std::cout << channel.read_until_prompt();
+    // The hull damage is too large to be a character
+    for (auto value: channel.take_values()) {
+        std::cout << value << std::endl;
+    }
 }
 
 
 int main(int argc, char **argv) {
-    auto input_stream = open_input_file(argc, argv);
-    auto program = load_intcode_program(input_stream);
+    auto program = load_intcode_program(input_filename(argc, argv));
 
     std::vector<Instruction> instructions_part1 {
         // Jump if hole three steps away
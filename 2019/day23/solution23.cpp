@@ -1,9 +1,8 @@
+#include <array>
 #include <iostream>
-#include <map>
 #include <sstream>
 #include <stdexcept>
-#include <thread>
-#include <utility>
+#include <vector>
 
 #include "intcode.h"
 #include "utils.h"
@@ -11,112 +10,130 @@
 
 constexpr size_t NUM_COMPUTERS = 50;
 constexpr size_t NAT_ADDRESS = 255;
-using packet_type = std::pair<intcode_type, intcode_type>;
+constexpr size_t PACKET_SIZE = 3;
 
 
 class NAT {
 public:
-    void intercept_packet(MultiQueue<intcode_type> &mq) {
-        auto packet = mq.pop_queue_multiple_blocking(NAT_ADDRESS, 2);
-        last_x = packet[0];
-        last_y = packet[1];
+    void intercept_packet(intcode_type x, intcode_type y) {
+        if (!received_packet) {
+            first_y = y;
+        }
+        last_x = x;
+        last_y = y;
+        received_packet = true;
     }
 
-    void release_packet(MultiQueue<intcode_type> &mq) {
-        mq.push_queue(0, {last_x, last_y});
+    void release_packet(IntcodeMachine &destination) {
+        destination.feed({last_x, last_y});
     }
 
+    intcode_type first_y = -1;
     intcode_type last_x = -1, last_y = -1;
+    bool received_packet = false;
 };
 
 
-std::thread launch_thread(const program_type &program,
-                          MultiQueue<intcode_type> &output_queue,
-                          MultiQueue<intcode_type> &input_queue,
-                          size_t address) {
-    auto intcode_input = [&input_queue, address]() -> intcode_type {
-        return input_queue.pop_queue_nonblocking(address, -1);
-    };
-
-    auto intcode_output = [&output_queue, &input_queue, address](intcode_type output) -> void {
-        output_queue.push_queue(address, output);
-        if (output_queue.get_queue_size(address) >= 3) {
-            // This computer has accumulated an address, an X and a Y
-            // in its output queue. Pass the packet to the destination.
-            auto values = output_queue.pop_queue_multiple_blocking(address, 3);
-            auto dest = values[0], x = values[1], y = values[2];
-            if (dest < 0 || (dest >= static_cast<intcode_type>(NUM_COMPUTERS)
-                             && dest != NAT_ADDRESS)) {
+// Simulates the whole network on a single thread. Each round, every NIC
+// runs until it needs more input, and the packets it sends are delivered
+// straight to the destination's input queue. A NIC with no pending
+// packets reads -1, as if it had polled an empty queue, until the machine
+// sees that it's only polling and parks it.
+class Network {
+public:
+    explicit Network(const program_type &program) {
+        for (size_t addr = 0; addr < NUM_COMPUTERS; ++addr) {
+            nics.emplace_back(program);
+            nics.back().set_default_input(-1);
+            // Each computer first receives its own address
+            nics.back().feed(static_cast<intcode_type>(addr));
+        }
+    }
+
+    // Run every NIC once and return the number of packets sent
+    size_t run_round(NAT &nat) {
+        size_t packets_sent = 0;
+        for (size_t addr = 0; addr < NUM_COMPUTERS; ++addr) {
+            auto &nic = nics[addr];
+            if (nic.run_until_input_needed() == IntcodeMachine::State::HALTED) {
                 std::stringstream error_message;
-                error_message << "Invalid destination address: " << dest;
+                error_message << "Computer " << addr << " halted unexpectedly";
                 throw std::runtime_error(error_message.str());
             }
-            input_queue.push_queue(dest, {x, y});
+            auto &partial = partial_packets[addr];
+            for (auto value: nic.take_outputs()) {
+                partial.push_back(value);
+                if (partial.size() == PACKET_SIZE) {
+                    deliver(partial[0], partial[1], partial[2], nat);
+                    partial.clear();
+                    ++packets_sent;
+                }
+            }
         }
-    };
-
-    return std::thread([program, intcode_input, intcode_output]() -> void {
-        run_intcode_program(program, intcode_input, intcode_output);
-    });
-}
-
+        return packets_sent;
+    }
 
-int main(int argc, char **argv) {
-    auto input_stream = open_input_file(argc, argv);
-    auto program = load_intcode_program(input_stream);
+    // The network is idle when every NIC is blocked on input
+    // and no packets are waiting to be read
+    bool is_idle() const {
+        for (auto &nic: nics) {
+            if (nic.pending_input() > 0) {
+                return false;
+            }
+        }
+        return true;
+    }
 
-    MultiQueue<intcode_type> output_queue, input_queue;
-    // Initialize input queue with each computer's address
-    for (size_t addr = 0; addr < NUM_COMPUTERS; ++addr) {
-        input_queue.push_queue(addr, addr);
+    IntcodeMachine &get_nic(size_t addr) {
+        return nics.at(addr);
     }
 
-    std::vector<std::thread> threads;
-    for (size_t addr = 0; addr < NUM_COMPUTERS; ++addr) {
-        threads.push_back(launch_thread(
-            program, output_queue, input_queue, addr));
+private:
+    void deliver(intcode_type dest, intcode_type x, intcode_type y, NAT &nat) {
+        if (dest == NAT_ADDRESS) {
+            nat.intercept_packet(x, y);
+            return;
+        }
+        if (dest < 0 || dest >= static_cast<intcode_type>(NUM_COMPUTERS)) {
+            std::stringstream error_message;
+            error_message << "Invalid destination address: " << dest;
+            throw std::runtime_error(error_message.str());
+        }
+        nics[dest].feed({x, y});
     }
 
+    std::vector<IntcodeMachine> nics;
+    std::array<std::vector<intcode_type>, NUM_COMPUTERS> partial_packets;
+};
+
+
+int main(int argc, char **argv) {
+    auto program = load_intcode_program(input_filename(argc, argv));
+
+    Network network(program);
     NAT nat_comp;
-    intcode_type first_y_to_nat = -1;
     intcode_type previous_y_emitted = -1;
     while (true) {
-        // Process any packets sent to NAT
-        while (input_queue.get_queue_size(NAT_ADDRESS) >= 2) {
-            nat_comp.intercept_packet(input_queue);
-            if (first_y_to_nat == -1) {
-                first_y_to_nat = nat_comp.last_y;
-            }
-        }
-        // Check if network is idle
-        // Hack: pass through the input queues multiple times to make sure
-        // the network really is idle. What's a better way to do this?
-        bool idle = true;
-        for (auto repeat = 0; repeat < 5; ++repeat) {
-            for (size_t addr = 0; addr < NUM_COMPUTERS; ++addr) {
-                if (input_queue.get_queue_size(addr) > 0) {
-                    idle = false;
-                    break;
-                }
+        auto packets_sent = network.run_round(nat_comp);
+        // Every NIC is parked without having sent anything,
+        // so nothing will happen until the NAT steps in
+        if (packets_sent == 0 && network.is_idle()) {
+            if (!nat_comp.received_packet) {
+                throw std::runtime_error("Network went idle before the NAT received a packet");
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        }
-        if (idle) {
             std::cout << "Emiting packet (" << nat_comp.last_x;
             std::cout << ", " << nat_comp.last_y << ") to address 0" << std::endl;
             if (previous_y_emitted == nat_comp.last_y) {
                 break;
             }
             previous_y_emitted = nat_comp.last_y;
-            nat_comp.release_packet(input_queue);
+            nat_comp.release_packet(network.get_nic(0));
         }
     }
 
-    // FIXME: clean up threads more cleanly
-
     std::cout << "PART 1" << std::endl;
     std::cout << "Y value of first packet to " << NAT_ADDRESS;
-    std::cout << ": " << first_y_to_nat << std::endl;
+    std::cout << ": " << nat_comp.first_y << std::endl;
     std::cout << std::endl;
     std::cout << "PART 2" << std::endl;
     std::cout << "First repeated Y value: " << previous_y_emitted << std::endl;
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <sstream>
+#include <stdexcept>
+
+
+// Throw, failing the test, unless condition holds
+#define CHECK(condition) check(condition, #condition, __FILE__, __LINE__)
+
+
+inline void check(bool condition, const char *text, const char *file, int line) {
+    if (!condition) {
+        std::stringstream error_message;
+        error_message << file << ":" << line << ": check failed: " << text;
+        throw std::runtime_error(error_message.str());
+    }
+}
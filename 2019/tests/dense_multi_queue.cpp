@@ -0,0 +1,88 @@
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "utils.h"
+
+
+using namespace std::chrono_literals;
+
+
+constexpr size_t NUM_QUEUES = 8;
+constexpr size_t NUM_PRODUCERS = 4;
+constexpr int VALUES_PER_PRODUCER = 2000;
+
+
+void test_single_thread() {
+    DenseMultiQueue<int> queues(NUM_QUEUES);
+    CHECK(queues.num_queues() == NUM_QUEUES);
+    queues.push_queue(3, {1, 2, 3});
+    CHECK(queues.get_queue_size(3) == 3);
+    CHECK(queues.get_queue_size(4) == 0);
+    CHECK((queues.pop_queue_multiple_blocking(3, 2) == std::vector<int>{1, 2}));
+    CHECK(queues.pop_queue_nonblocking(3, -1) == 3);
+    CHECK(queues.pop_queue_nonblocking(3, -1) == -1);
+    CHECK(queues.pop_queue_multiple_blocking_for(3, 1, 10ms).empty());
+
+    auto rejected = false;
+    try {
+        queues.push_queue(NUM_QUEUES, 1);
+    } catch (const std::out_of_range &) {
+        rejected = true;
+    }
+    CHECK(rejected);
+}
+
+
+// Several producers push pairs to every queue at once, while one consumer
+// per queue pops them. Each pair is pushed in one call, so it must come out
+// whole, and each producer's pairs must come out in the order it pushed them.
+void test_contention() {
+    DenseMultiQueue<int> queues(NUM_QUEUES);
+    std::vector<std::thread> threads;
+    for (size_t producer = 0; producer < NUM_PRODUCERS; ++producer) {
+        threads.emplace_back([&queues, producer]() -> void {
+            auto id = static_cast<int>(producer);
+            for (auto value = 0; value < VALUES_PER_PRODUCER; ++value) {
+                for (size_t queue = 0; queue < NUM_QUEUES; ++queue) {
+                    queues.push_queue(queue, {id, value});
+                }
+            }
+        });
+    }
+    // Not vector<bool>, whose elements share bytes between threads
+    std::vector<char> ok(NUM_QUEUES, false);
+    for (size_t queue = 0; queue < NUM_QUEUES; ++queue) {
+        threads.emplace_back([&queues, &ok, queue]() -> void {
+            std::vector<int> next(NUM_PRODUCERS, 0);
+            auto valid = true;
+            for (size_t count = 0; count < NUM_PRODUCERS * VALUES_PER_PRODUCER; ++count) {
+                auto pair = queues.pop_queue_multiple_blocking_for(queue, 2, 10s);
+                if (pair.size() != 2 || pair[0] < 0
+                        || pair[0] >= static_cast<int>(NUM_PRODUCERS)
+                        || pair[1] != next[pair[0]]++) {
+                    valid = false;
+                    break;
+                }
+            }
+            ok[queue] = valid;
+        });
+    }
+    for (auto &thd: threads) {
+        thd.join();
+    }
+    for (size_t queue = 0; queue < NUM_QUEUES; ++queue) {
+        CHECK(ok[queue]);
+        CHECK(queues.get_queue_size(queue) == 0);
+    }
+}
+
+
+int main() {
+    test_single_thread();
+    test_contention();
+    std::cout << "dense_multi_queue: OK" << std::endl;
+}
@@ -0,0 +1,52 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "intcode.h"
+
+
+// Reads n, then counts down from it, outputting three times each count
+const std::string COUNTDOWN_TEXT = "3,20,1002,20,3,21,4,21,1001,20,-1,20,1005,20,2,99";
+
+
+std::vector<intcode_type> run_sequentially(const IntcodeMachine &start,
+                                           const std::vector<intcode_type> &inputs) {
+    auto machine = start.fork();
+    for (auto value: inputs) {
+        machine.feed(value);
+    }
+    machine.run_until_input_needed();
+    return machine.take_outputs();
+}
+
+
+void test_matches_sequential() {
+    IntcodeMachine start(parse_intcode_program(COUNTDOWN_TEXT.data(), COUNTDOWN_TEXT.size()));
+    // Forks from partway through the program, as well as the start
+    auto waiting = start.fork();
+    CHECK(waiting.run_until_input_needed() == IntcodeMachine::State::NEEDS_INPUT);
+
+    std::vector<std::vector<intcode_type> > inputs{{}};
+    for (intcode_type n = 1; n <= 200; ++n) {
+        inputs.push_back({n});
+    }
+    for (auto machine: {&start, &waiting}) {
+        auto outputs = run_intcode_batch(*machine, inputs);
+        CHECK(outputs.size() == inputs.size());
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            CHECK(outputs[i] == run_sequentially(*machine, inputs[i]));
+        }
+        CHECK(outputs[0].empty());
+        CHECK((outputs[2] == std::vector<intcode_type>{6, 3}));
+    }
+    // The forks didn't touch the machines they came from
+    CHECK(start.read(20) == 0);
+    CHECK(start.get_state() == IntcodeMachine::State::READY);
+}
+
+
+int main() {
+    test_matches_sequential();
+    std::cout << "intcode_batch: OK" << std::endl;
+}
@@ -0,0 +1,70 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "intcode.h"
+
+
+// Outputs the sum of two inputs
+const std::string SUM_TEXT = "3,20,3,21,1,20,21,22,4,22,99";
+const std::string CACHE_FILENAME = "tests/intcode_cache.txt";
+
+
+program_type sum_program() {
+    return parse_intcode_program(SUM_TEXT.data(), SUM_TEXT.size());
+}
+
+
+void test_probe_all_duplicates() {
+    IntcodeProbeCache cache(sum_program());
+    // Repeated inputs, and lanes whose values are all equal
+    auto outputs = cache.probe_all({{1, 2}, {3, 3}, {1, 2}, {3, 3}, {4, 5}});
+    CHECK(outputs.size() == 5);
+    CHECK(outputs[0] == std::vector<intcode_type>{3});
+    CHECK(outputs[1] == std::vector<intcode_type>{6});
+    CHECK(outputs[2] == std::vector<intcode_type>{3});
+    CHECK(outputs[3] == std::vector<intcode_type>{6});
+    CHECK(outputs[4] == std::vector<intcode_type>{9});
+    CHECK(cache.misses() == 3);
+    CHECK(cache.hits() == 2);
+
+    outputs = cache.probe_all({{4, 5}, {1, 2}});
+    CHECK(outputs[0] == std::vector<intcode_type>{9});
+    CHECK(cache.misses() == 3);
+    CHECK(cache.hits() == 4);
+}
+
+
+// A file with a bad line in the middle, and one torn off at the end
+void test_load_skips_malformed() {
+    auto hash = IntcodeProbeCache(sum_program()).program_hash();
+    {
+        std::ofstream file(CACHE_FILENAME);
+        file << std::hex << hash << std::dec << " 2 1 2 1 3\n";
+        file << std::hex << hash << std::dec << " 2 1 x 1 3\n";
+        file << std::hex << hash << std::dec << " 2 3 4 1 7 8\n";
+        file << std::hex << hash << std::dec << " 2 5 5 1";
+    }
+    {
+        IntcodeProbeCache cache(sum_program(), CACHE_FILENAME);
+        CHECK(cache.probe({1, 2}) == std::vector<intcode_type>{3});
+        CHECK(cache.hits() == 1);
+        CHECK(cache.probe({5, 5}) == std::vector<intcode_type>{10});
+        CHECK(cache.misses() == 1);
+    }
+    // The new result went on a line of its own
+    IntcodeProbeCache cache(sum_program(), CACHE_FILENAME);
+    CHECK(cache.probe({5, 5}) == std::vector<intcode_type>{10});
+    CHECK(cache.hits() == 1);
+    std::remove(CACHE_FILENAME.c_str());
+}
+
+
+int main() {
+    test_probe_all_duplicates();
+    test_load_skips_malformed();
+    std::cout << "intcode_cache: OK" << std::endl;
+}
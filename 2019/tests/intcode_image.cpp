@@ -0,0 +1,143 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "check.h"
+#include "intcode.h"
+
+
+const std::string IMAGE_FILENAME = "tests/intcode_image.img";
+const std::string PROGRAM_TEXT = "1,0,0,0,99";
+// Offset of the decoded instruction table in an image of PROGRAM_TEXT
+constexpr size_t HANDLERS_OFFSET = 24 + 5 * 8;
+
+
+std::string save_image() {
+    auto program = parse_intcode_program(PROGRAM_TEXT.data(), PROGRAM_TEXT.size());
+    std::stringstream image;
+    save_intcode_image(program, 5, image);
+    return image.str();
+}
+
+
+void write_file(const std::string &bytes) {
+    std::ofstream file(IMAGE_FILENAME, std::ios::binary);
+    file << bytes;
+}
+
+
+template <typename Func>
+bool throws_runtime_error(Func func) {
+    try {
+        func();
+    } catch (const std::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+
+void test_round_trip() {
+    write_file(save_image());
+    auto image = load_intcode_image(IMAGE_FILENAME);
+    IntcodeMachine machine(image);
+    CHECK(machine.run_until_input_needed() == IntcodeMachine::State::HALTED);
+    CHECK(machine.read(0) == 2);
+}
+
+
+// The table is only checked when the machine runs the corrupt cell
+bool corrupt_run_throws() {
+    auto image = load_intcode_image(IMAGE_FILENAME);
+    IntcodeMachine machine(image);
+    return throws_runtime_error([&machine]() -> void { machine.run_until_input_needed(); });
+}
+
+
+void test_corrupt_handlers() {
+    auto bytes = save_image();
+    // An index past the end of the handler table
+    bytes[HANDLERS_OFFSET] = '\xff';
+    bytes[HANDLERS_OFFSET + 1] = '\xff';
+    write_file(bytes);
+    CHECK(corrupt_run_throws());
+
+    // A valid index, but for a different instruction than the cell holds
+    bytes = save_image();
+    bytes[HANDLERS_OFFSET] = static_cast<char>(
+        handler_index(Opcode::MULTIPLY, {Mode::POSITIONAL, Mode::POSITIONAL, Mode::POSITIONAL}));
+    bytes[HANDLERS_OFFSET + 1] = 0;
+    write_file(bytes);
+    CHECK(corrupt_run_throws());
+}
+
+
+// An entry which no longer matches its cell because the machine has
+// overwritten it isn't corrupt, and the new instruction is run instead
+void test_overwritten_cell() {
+    write_file(save_image());
+    auto image = load_intcode_image(IMAGE_FILENAME);
+    IntcodeMachine machine(image);
+    machine.write(0, 2);
+    CHECK(machine.run_until_input_needed() == IntcodeMachine::State::HALTED);
+    CHECK(machine.read(0) == 4);
+}
+
+
+// Files are read or mapped depending on their size, so load both
+// small and large programs, as text and as images
+void test_load_program_file() {
+    for (size_t num_cells: {size_t{5}, IntcodeMemory::PAGE_SIZE * 3 + 5}) {
+        auto program = parse_intcode_program(PROGRAM_TEXT.data(), PROGRAM_TEXT.size());
+        std::string text = PROGRAM_TEXT;
+        for (size_t address = 5; address < num_cells; ++address) {
+            program[static_cast<intcode_type>(address)] = static_cast<intcode_type>(address);
+            text += "," + std::to_string(address);
+        }
+        write_file(text);
+        auto from_text = load_intcode_program(IMAGE_FILENAME);
+        std::stringstream image;
+        save_intcode_image(program, num_cells, image);
+        write_file(image.str());
+        auto from_image = load_intcode_program(IMAGE_FILENAME);
+        for (size_t address = 0; address < num_cells; ++address) {
+            CHECK(from_text.read(address) == program.read(address));
+            CHECK(from_image.read(address) == program.read(address));
+        }
+    }
+}
+
+
+// A header claiming far more cells than the stream holds
+void test_oversized_stream() {
+    auto bytes = save_image().substr(0, HANDLERS_OFFSET);
+    for (size_t i = 16; i < 24; ++i) {
+        bytes[i] = '\x7f';
+    }
+    std::stringstream stream(bytes);
+    CHECK(throws_runtime_error([&stream]() -> void { read_intcode_image(stream); }));
+
+    // Within the limit, but still more than the stream holds
+    bytes[16] = 0;
+    bytes[17] = 0;
+    bytes[18] = 0x10;
+    for (size_t i = 19; i < 24; ++i) {
+        bytes[i] = 0;
+    }
+    std::stringstream short_stream(bytes);
+    CHECK(throws_runtime_error([&short_stream]() -> void { read_intcode_image(short_stream); }));
+}
+
+
+int main() {
+    test_round_trip();
+    test_corrupt_handlers();
+    test_overwritten_cell();
+    test_load_program_file();
+    test_oversized_stream();
+    std::remove(IMAGE_FILENAME.c_str());
+    std::cout << "intcode_image: OK" << std::endl;
+}
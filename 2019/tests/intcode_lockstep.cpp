@@ -0,0 +1,62 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "intcode.h"
+
+
+program_type parse(const std::string &text) {
+    return parse_intcode_program(text.data(), text.size());
+}
+
+
+// Reads an input, adds it to the relative base and outputs 7
+const std::string read_then_rel_base = "3,100,9,100,104,7,99";
+
+
+// Lanes which are given the same input store the same value, so they
+// must stay in lockstep when the value is used as an operand
+void test_identical_inputs() {
+    IntcodeMachine start(parse(read_then_rel_base));
+    std::vector<std::vector<intcode_type> > inputs(4, {5});
+    auto outputs = run_intcode_lockstep(start, inputs);
+    CHECK(outputs.size() == inputs.size());
+    for (const auto &lane_outputs: outputs) {
+        CHECK(lane_outputs == std::vector<intcode_type>{7});
+    }
+}
+
+
+void test_identical_writes() {
+    IntcodeBatch batch(IntcodeMachine(parse(read_then_rel_base)), 3);
+    for (size_t lane = 0; lane < batch.size(); ++lane) {
+        batch.write(lane, 100, 2);
+        batch.feed(lane, 2);
+    }
+    batch.run();
+    CHECK(batch.num_scalar_lanes() == 0);
+    for (size_t lane = 0; lane < batch.size(); ++lane) {
+        CHECK(batch.take_outputs(lane) == std::vector<intcode_type>{7});
+    }
+}
+
+
+// Lanes whose inputs differ split off once the input decides control flow
+void test_diverging_inputs() {
+    // Outputs 1 if the input is 0, otherwise 2
+    IntcodeMachine start(parse("3,20,1006,20,9,104,2,99,0,104,1,99"));
+    auto outputs = run_intcode_lockstep(start, {{0}, {3}, {0}, {0}});
+    CHECK(outputs[0] == std::vector<intcode_type>{1});
+    CHECK(outputs[1] == std::vector<intcode_type>{2});
+    CHECK(outputs[2] == std::vector<intcode_type>{1});
+    CHECK(outputs[3] == std::vector<intcode_type>{1});
+}
+
+
+int main() {
+    test_identical_inputs();
+    test_identical_writes();
+    test_diverging_inputs();
+    std::cout << "intcode_lockstep: OK" << std::endl;
+}
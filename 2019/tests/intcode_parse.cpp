@@ -0,0 +1,50 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "check.h"
+#include "intcode.h"
+
+
+program_type parse(const std::string &text) {
+    return parse_intcode_program(text.data(), text.size());
+}
+
+
+bool is_rejected(const std::string &text) {
+    try {
+        parse(text);
+    } catch (const std::invalid_argument &) {
+        return true;
+    }
+    return false;
+}
+
+
+void test_separators() {
+    for (auto text: {"1,-2,3", " 1 , -2,\n3\n", "1,-2,3,", "1,-2,3,\n", "1,-2,3 ,\r\n"}) {
+        const auto program = parse(text);
+        CHECK(program.read(0) == 1);
+        CHECK(program.read(1) == -2);
+        CHECK(program.read(2) == 3);
+        CHECK(program.read(3) == 0);
+    }
+    CHECK(parse("").size() == 0);
+}
+
+
+void test_malformed() {
+    CHECK(is_rejected(","));
+    CHECK(is_rejected("1,,2"));
+    CHECK(is_rejected("1,2,,"));
+    CHECK(is_rejected("1 2"));
+    CHECK(is_rejected("1,x"));
+    CHECK(is_rejected("9223372036854775808"));
+}
+
+
+int main() {
+    test_separators();
+    test_malformed();
+    std::cout << "intcode_parse: OK" << std::endl;
+}
@@ -0,0 +1,48 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "intcode.h"
+
+
+// Polls for input forever, counting polls in cell 101
+const std::string COUNTER_TEXT = "3,100,1001,101,1,101,1105,1,0";
+
+
+IntcodeMachine counter_machine() {
+    IntcodeMachine machine(parse_intcode_program(COUNTER_TEXT.data(), COUNTER_TEXT.size()));
+    machine.set_default_input(-1);
+    return machine;
+}
+
+
+void test_counter_parks() {
+    auto machine = counter_machine();
+    CHECK(machine.run_until_input_needed() == IntcodeMachine::State::NEEDS_INPUT);
+    auto polls = machine.read(101);
+    CHECK(polls > 0);
+    CHECK(polls <= static_cast<intcode_type>(IntcodeMachine::MAX_IDLE_POLLS) + 1);
+
+    // It stays parked until it's fed, then polls again
+    CHECK(machine.run_until_input_needed() == IntcodeMachine::State::NEEDS_INPUT);
+    CHECK(machine.read(101) == polls);
+    machine.feed(5);
+    CHECK(machine.run_until_input_needed() == IntcodeMachine::State::NEEDS_INPUT);
+    CHECK(machine.read(101) > polls);
+}
+
+
+void test_executor_returns() {
+    IntcodeExecutor executor(2);
+    executor.add_machine(counter_machine());
+    executor.add_machine(counter_machine());
+    executor.run([](size_t, const std::vector<intcode_type> &) -> void {});
+}
+
+
+int main() {
+    test_counter_parks();
+    test_executor_returns();
+    std::cout << "intcode_polling: OK" << std::endl;
+}
@@ -0,0 +1,52 @@
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "utils.h"
+
+
+using namespace std::chrono_literals;
+
+
+void test_timed_wait_expires() {
+    MultiQueue<int> queues;
+    queues.push_queue(0, 1);
+    auto start = std::chrono::steady_clock::now();
+    // Only one of the two values asked for ever arrives
+    CHECK(queues.pop_queue_multiple_blocking_for(0, 2, 20ms).empty());
+    CHECK(std::chrono::steady_clock::now() - start >= 20ms);
+    // Nothing was taken
+    CHECK(queues.get_queue_size(0) == 1);
+    CHECK(queues.pop_queue_nonblocking(0, -1) == 1);
+    CHECK(queues.pop_queue_nonblocking(0, -1) == -1);
+}
+
+
+void test_wake_on_push() {
+    MultiQueue<int> queues;
+    std::thread producer([&queues]() -> void {
+        std::this_thread::sleep_for(10ms);
+        // Values for another queue mustn't satisfy the consumer
+        queues.push_queue(1, {7, 8});
+        queues.push_queue(0, 1);
+        queues.push_queue(0, {2, 3});
+    });
+    auto start = std::chrono::steady_clock::now();
+    auto values = queues.pop_queue_multiple_blocking_for(0, 3, 10s);
+    // Woken by the push, long before the timeout
+    CHECK(std::chrono::steady_clock::now() - start < 5s);
+    producer.join();
+    CHECK((values == std::vector<int>{1, 2, 3}));
+    CHECK(queues.get_queue_size(0) == 0);
+    CHECK(queues.pop_queue_blocking(1) == 7);
+    CHECK(queues.get_queue_size(1) == 1);
+}
+
+
+int main() {
+    test_timed_wait_expires();
+    test_wake_on_push();
+    std::cout << "multi_queue: OK" << std::endl;
+}
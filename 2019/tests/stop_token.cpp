@@ -0,0 +1,47 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "check.h"
+#include "intcode.h"
+#include "utils.h"
+
+
+// Jumps back to itself forever
+const std::string endless_loop = "1105,1,0";
+
+
+void test_parallel_for_stops() {
+    StopToken stop_token;
+    std::atomic<size_t> calls{0};
+    size_t count = 100000;
+    parallel_for(count, [&](size_t) -> void {
+        ++calls;
+        stop_token.request_stop();
+    }, stop_token);
+    CHECK(calls < count);
+}
+
+
+void test_executor_stops_endless_machine() {
+    IntcodeExecutor executor(2);
+    auto program = parse_intcode_program(endless_loop.data(), endless_loop.size());
+    executor.add_machine(IntcodeMachine(program));
+    StopToken stop_token;
+    std::thread stopper([&stop_token]() -> void {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        stop_token.request_stop();
+    });
+    executor.run([](size_t, const std::vector<intcode_type> &) -> void {}, stop_token);
+    stopper.join();
+    CHECK(executor.machine(0).get_state() == IntcodeMachine::State::STOPPED);
+}
+
+
+int main() {
+    test_parallel_for_stops();
+    test_executor_stops_endless_machine();
+    std::cout << "stop_token: OK" << std::endl;
+}
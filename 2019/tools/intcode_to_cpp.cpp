@@ -0,0 +1,455 @@
+#include <array>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "intcode.h"
+
+
+// Translates an Intcode program into C++ which can be attached to an
+// IntcodeMachine with set_native_program(). Every instruction reachable
+// from address 0 becomes straight-line code with its operands baked in.
+// Operands which the program itself overwrites are read from memory instead.
+// Computed jumps go through a switch over the known instruction addresses,
+// and anything the translator didn't see (unknown jump targets, invalid
+// instructions, writes to the program's own code) returns control to
+// the interpreter.
+//
+// Usage: intcode_to_cpp.exe input.txt symbol_name > output.cpp
+
+
+struct DecodedInstruction {
+    IntcodeInstruction instruction;
+    intcode_type address;
+    std::array<intcode_type, 3> params;
+    // Operands the program overwrites, see Translator::find_patched_operands()
+    std::array<bool, 3> patched;
+    intcode_type length;
+    bool valid;
+};
+
+using listing_type = std::map<intcode_type, DecodedInstruction>;
+
+
+// Index of the operand an instruction writes to, or -1 if it doesn't write
+int write_operand(const IntcodeInstruction &instruction) {
+    switch (instruction.opcode) {
+        case Opcode::ADD:
+        case Opcode::MULTIPLY:
+        case Opcode::LESS_THAN:
+        case Opcode::EQUALS:
+            return 2;
+        case Opcode::INPUT:
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+
+bool writes_immediate(const IntcodeInstruction &instruction) {
+    auto index = write_operand(instruction);
+    return index >= 0 && instruction.modes[index] == Mode::IMMEDIATE;
+}
+
+
+bool is_jump(const IntcodeInstruction &instruction) {
+    return instruction.opcode == Opcode::JUMP_TRUE || instruction.opcode == Opcode::JUMP_FALSE;
+}
+
+
+// Whether a jump's condition is an immediate which means it's always taken
+bool always_jumps(const DecodedInstruction &decoded) {
+    if (!is_jump(decoded.instruction) || decoded.instruction.modes[0] != Mode::IMMEDIATE
+            || decoded.patched[0]) {
+        return false;
+    }
+    auto condition = decoded.params[0];
+    return decoded.instruction.opcode == Opcode::JUMP_TRUE ? condition != 0 : condition == 0;
+}
+
+
+// Whether execution never continues to the next instruction
+bool ends_block(const DecodedInstruction &decoded) {
+    return decoded.instruction.opcode == Opcode::END || always_jumps(decoded);
+}
+
+
+// The value an ADD or MULTIPLY with two immediate operands stores, if any.
+// Programs save return addresses this way before jumping to a function.
+bool stored_constant(const DecodedInstruction &decoded, intcode_type &value) {
+    const auto &instruction = decoded.instruction;
+    if (instruction.modes[0] != Mode::IMMEDIATE || instruction.modes[1] != Mode::IMMEDIATE) {
+        return false;
+    }
+    if (instruction.opcode == Opcode::ADD) {
+        value = decoded.params[0] + decoded.params[1];
+        return true;
+    }
+    if (instruction.opcode == Opcode::MULTIPLY) {
+        value = decoded.params[0] * decoded.params[1];
+        return true;
+    }
+    return false;
+}
+
+
+// Find every instruction reachable from address 0 by falling through or
+// taking a jump with an immediate destination. Cells after a halt or an
+// unconditional jump are often data, so they're only treated as code if
+// something leads there: a jump, or a constant stored by code already
+// found, which is how a call saves the address its function returns to.
+listing_type discover_instructions(const program_type &program) {
+    auto program_size = static_cast<intcode_type>(program.size());
+    listing_type listing;
+    // Addresses after the end of a block, and constants stored by code
+    std::set<intcode_type> block_ends, constants;
+    std::deque<intcode_type> to_visit{0};
+    auto visit_return_address = [&](intcode_type address) -> void {
+        if (block_ends.count(address) && constants.count(address)) {
+            to_visit.push_back(address);
+        }
+    };
+    while (!to_visit.empty()) {
+        auto address = to_visit.front();
+        to_visit.pop_front();
+        if (address < 0 || address >= program_size
+                || listing.find(address) != listing.end()) {
+            continue;
+        }
+        DecodedInstruction decoded{};
+        decoded.address = address;
+        try {
+            decoded.instruction = decode_instruction(program.read(address));
+            decoded.valid = !writes_immediate(decoded.instruction);
+        } catch (const std::invalid_argument &) {
+            decoded.valid = false;
+        }
+        if (!decoded.valid) {
+            listing[address] = decoded;
+            continue;
+        }
+        auto num_params = num_operands(decoded.instruction.opcode);
+        decoded.length = 1 + num_params;
+        for (auto i = 0; i < num_params; ++i) {
+            decoded.params[i] = program.read(address + 1 + i);
+        }
+        listing[address] = decoded;
+
+        intcode_type constant;
+        if (stored_constant(decoded, constant) && constants.insert(constant).second) {
+            visit_return_address(constant);
+        }
+        if (is_jump(decoded.instruction) && decoded.instruction.modes[1] == Mode::IMMEDIATE) {
+            to_visit.push_back(decoded.params[1]);
+        }
+        auto next_address = address + decoded.length;
+        if (!ends_block(decoded)) {
+            to_visit.push_back(next_address);
+        } else if (block_ends.insert(next_address).second) {
+            visit_return_address(next_address);
+        }
+    }
+    return listing;
+}
+
+
+std::string literal(intcode_type value) {
+    std::stringstream stream;
+    stream << value << "LL";
+    return stream.str();
+}
+
+
+// A patched operand has to be read from memory each time
+std::string operand_value(const DecodedInstruction &decoded, int index) {
+    if (decoded.patched[index]) {
+        return "READ(" + literal(decoded.address + 1 + index) + ")";
+    }
+    return literal(decoded.params[index]);
+}
+
+
+std::string read_operand(const DecodedInstruction &decoded, int index) {
+    auto param = operand_value(decoded, index);
+    switch (decoded.instruction.modes[index]) {
+        case Mode::POSITIONAL:
+            return "READ(" + param + ")";
+        case Mode::IMMEDIATE:
+            return param;
+        case Mode::RELATIVE:
+            return "READ(rb + " + param + ")";
+    }
+    throw std::logic_error("Unexpected mode");
+}
+
+
+std::string write_address(const DecodedInstruction &decoded, int index) {
+    auto param = operand_value(decoded, index);
+    return decoded.instruction.modes[index] == Mode::RELATIVE ? "rb + " + param : param;
+}
+
+
+class Translator {
+public:
+    Translator(const program_type &prog): program(prog), listing(discover_instructions(prog)) {
+        auto patched_cells = find_patched_operands();
+        for (auto &entry: listing) {
+            if (!entry.second.valid) {
+                continue;
+            }
+            for (auto i = 0; i < entry.second.length; ++i) {
+                if (!patched_cells.count(entry.first + i)) {
+                    code_cells.insert(entry.first + i);
+                }
+            }
+        }
+        find_labels();
+    }
+
+    void emit(std::ostream &out, const std::string &symbol_name) const {
+        auto image_size = code_cells.empty() ? 0 : *code_cells.rbegin() + 1;
+        out << "// Generated by tools/intcode_to_cpp. Do not edit.\n";
+        out << "#include \"intcode.h\"\n\n\n";
+        out << "namespace {\n\n";
+        out << "const intcode_type IMAGE[] = {";
+        for (intcode_type address = 0; address < image_size; ++address) {
+            out << (address % 8 == 0 ? "\n    " : " ") << literal(program.read(address)) << ",";
+        }
+        out << "\n};\n\n";
+        out << "const unsigned char CODE_CELLS[] = {";
+        for (intcode_type address = 0; address < image_size; ++address) {
+            out << (address % 32 == 0 ? "\n    " : " ");
+            out << (code_cells.count(address) ? 1 : 0) << ",";
+        }
+        out << "\n};\n\n";
+        out << "constexpr size_t IMAGE_SIZE = " << image_size << ";\n\n\n";
+
+        out << "#define READ(address) machine.read(address)\n";
+        out << "#define EXIT(at, new_state) \\\n";
+        out << "    do { s.pc = (at); s.relative_base = rb; return (new_state); } while (0)\n";
+        out << "#define CHECK_STOP(at) \\\n";
+        out << "    do { if (s.stop_token.stop_requested()) EXIT(at, State::STOPPED); } while (0)\n";
+        out << "#define WRITE_CHECKED(next, address, value) \\\n";
+        out << "    do { \\\n";
+        out << "        intcode_type target = (address); \\\n";
+        out << "        machine.write(target, (value)); \\\n";
+        out << "        if (static_cast<size_t>(target) < IMAGE_SIZE && CODE_CELLS[target]) \\\n";
+        out << "            EXIT(next, State::READY); \\\n";
+        out << "    } while (0)\n\n";
+
+        out << "using State = IntcodeMachine::State;\n\n\n";
+        out << "State run_native(IntcodeMachine::NativeState &s) {\n";
+        out << "    auto &machine = s.machine;\n";
+        out << "    auto pc = s.pc;\n";
+        out << "    auto rb = s.relative_base;\n";
+        out << "dispatch:\n";
+        out << "    switch (pc) {\n";
+        for (auto iter = listing.begin(); iter != listing.end(); ++iter) {
+            emit_instruction(out, iter->first, iter->second);
+            auto next_iter = std::next(iter);
+            auto next_address = iter->first + iter->second.length;
+            if (!iter->second.valid || ends_block(iter->second)) {
+                continue;
+            }
+            if (next_iter != listing.end() && next_iter->first == next_address) {
+                out << "            [[fallthrough]];\n";
+                continue;
+            }
+            emit_goto(out, next_address);
+        }
+        out << "        default:\n";
+        out << "            EXIT(pc, State::READY);\n";
+        out << "    }\n";
+        out << "}\n\n";
+        out << "#undef READ\n#undef EXIT\n#undef CHECK_STOP\n#undef WRITE_CHECKED\n\n";
+        out << "}  // namespace\n\n\n";
+        out << "extern const IntcodeMachine::NativeProgram " << symbol_name << ";\n";
+        out << "const IntcodeMachine::NativeProgram " << symbol_name;
+        out << "{run_native, IMAGE, CODE_CELLS, IMAGE_SIZE};\n";
+    }
+
+private:
+    // Programs often store a pointer straight into the operand of a later
+    // instruction, since that's the only way to dereference it. Operands
+    // written to by a positional write are read from memory when they're
+    // used instead of being compiled in, and aren't counted as code, so
+    // writing them doesn't send the machine back to the interpreter.
+    // Returns the addresses of those operands.
+    std::set<intcode_type> find_patched_operands() {
+        std::set<intcode_type> operand_cells, patched_cells;
+        for (auto &entry: listing) {
+            for (auto i = 1; entry.second.valid && i < entry.second.length; ++i) {
+                if (!is_instruction(entry.first + i)) {
+                    operand_cells.insert(entry.first + i);
+                }
+            }
+        }
+        for (auto &entry: listing) {
+            const auto &decoded = entry.second;
+            auto index = decoded.valid ? write_operand(decoded.instruction) : -1;
+            if (index >= 0 && decoded.instruction.modes[index] == Mode::POSITIONAL
+                    && operand_cells.count(decoded.params[index])) {
+                patched_cells.insert(decoded.params[index]);
+            }
+        }
+        for (auto &entry: listing) {
+            auto &decoded = entry.second;
+            for (auto i = 0; decoded.valid && i < decoded.length - 1; ++i) {
+                decoded.patched[i] = patched_cells.count(entry.first + 1 + i) > 0;
+            }
+        }
+        return patched_cells;
+    }
+
+    // Addresses which need a label because code jumps straight to them
+    void find_labels() {
+        for (auto iter = listing.begin(); iter != listing.end(); ++iter) {
+            auto &decoded = iter->second;
+            if (!decoded.valid) {
+                continue;
+            }
+            if (is_jump(decoded.instruction) && decoded.instruction.modes[1] == Mode::IMMEDIATE
+                    && !decoded.patched[1] && is_instruction(decoded.params[1])) {
+                labels.insert(decoded.params[1]);
+            }
+            auto next_iter = std::next(iter);
+            auto next_address = iter->first + decoded.length;
+            if (!ends_block(decoded) && is_instruction(next_address)
+                    && (next_iter == listing.end() || next_iter->first != next_address)) {
+                labels.insert(next_address);
+            }
+        }
+    }
+
+    bool is_instruction(intcode_type address) const {
+        return listing.find(address) != listing.end();
+    }
+
+    void emit_goto(std::ostream &out, intcode_type address) const {
+        if (labels.count(address)) {
+            out << "            goto a" << address << ";\n";
+        } else {
+            out << "            pc = " << literal(address) << ";\n";
+            out << "            goto dispatch;\n";
+        }
+    }
+
+    void emit_write(std::ostream &out, const DecodedInstruction &decoded, int index,
+                    intcode_type next_address, const std::string &value) const {
+        auto address = write_address(decoded, index);
+        if (decoded.instruction.modes[index] == Mode::POSITIONAL && !decoded.patched[index]
+                && !code_cells.count(decoded.params[index])) {
+            // Known not to touch the program's code
+            out << "            machine.write(" << address << ", " << value << ");\n";
+        } else {
+            out << "            WRITE_CHECKED(" << literal(next_address) << ", ";
+            out << address << ", " << value << ");\n";
+        }
+    }
+
+    void emit_instruction(std::ostream &out, intcode_type address,
+                          const DecodedInstruction &decoded) const {
+        out << "        case " << literal(address) << ":\n";
+        if (labels.count(address)) {
+            out << "        a" << address << ":\n";
+        }
+        if (!decoded.valid) {
+            // Let the interpreter report the error
+            out << "            EXIT(" << literal(address) << ", State::READY);\n";
+            return;
+        }
+        auto next_address = address + decoded.length;
+        switch (decoded.instruction.opcode) {
+            case Opcode::ADD:
+                emit_write(out, decoded, 2, next_address,
+                           read_operand(decoded, 0) + " + " + read_operand(decoded, 1));
+                break;
+            case Opcode::MULTIPLY:
+                emit_write(out, decoded, 2, next_address,
+                           read_operand(decoded, 0) + " * " + read_operand(decoded, 1));
+                break;
+            case Opcode::LESS_THAN:
+                emit_write(out, decoded, 2, next_address,
+                           "(" + read_operand(decoded, 0) + " < "
+                           + read_operand(decoded, 1) + " ? 1 : 0)");
+                break;
+            case Opcode::EQUALS:
+                emit_write(out, decoded, 2, next_address,
+                           "(" + read_operand(decoded, 0) + " == "
+                           + read_operand(decoded, 1) + " ? 1 : 0)");
+                break;
+            case Opcode::INPUT:
+                out << "            CHECK_STOP(" << literal(address) << ");\n";
+                out << "            if (s.inputs.empty()) {\n";
+                out << "                EXIT(" << literal(address) << ", State::NEEDS_INPUT);\n";
+                out << "            }\n";
+                out << "            {\n";
+                out << "            auto value = s.inputs.front();\n";
+                out << "            s.inputs.pop_front();\n";
+                emit_write(out, decoded, 0, next_address, "value");
+                out << "            }\n";
+                break;
+            case Opcode::OUTPUT:
+                out << "            s.outputs.push_back(" << read_operand(decoded, 0) << ");\n";
+                out << "            if (s.stop_on_output) {\n";
+                out << "                EXIT(" << literal(next_address) << ", State::HAS_OUTPUT);\n";
+                out << "            }\n";
+                break;
+            case Opcode::JUMP_TRUE:
+            case Opcode::JUMP_FALSE: {
+                out << "            CHECK_STOP(" << literal(address) << ");\n";
+                // Nothing follows an unconditional jump, see ends_block()
+                auto conditional = !always_jumps(decoded);
+                if (conditional) {
+                    out << "            if (" << read_operand(decoded, 0);
+                    out << (decoded.instruction.opcode == Opcode::JUMP_TRUE ? " != 0" : " == 0");
+                    out << ") {\n";
+                }
+                if (decoded.instruction.modes[1] == Mode::IMMEDIATE && !decoded.patched[1]) {
+                    emit_goto(out, decoded.params[1]);
+                } else {
+                    out << "            pc = " << read_operand(decoded, 1) << ";\n";
+                    out << "            goto dispatch;\n";
+                }
+                if (conditional) {
+                    out << "            }\n";
+                }
+                break;
+            }
+            case Opcode::REL_BASE:
+                out << "            rb += " << read_operand(decoded, 0) << ";\n";
+                break;
+            case Opcode::END:
+                out << "            EXIT(" << literal(address) << ", State::HALTED);\n";
+                break;
+        }
+    }
+
+    const program_type &program;
+    listing_type listing;
+    std::set<intcode_type> code_cells;
+    std::set<intcode_type> labels;
+};
+
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " input.txt symbol_name" << std::endl;
+        return 1;
+    }
+    std::ifstream input_stream(argv[1]);
+    if (!input_stream) {
+        std::cerr << "File not found: " << argv[1] << std::endl;
+        return 1;
+    }
+    auto program = load_intcode_program(input_stream);
+    Translator translator(program);
+    translator.emit(std::cout, argv[2]);
+    return 0;
+}
@@ -0,0 +1,37 @@
+#include <fstream>
+#include <iostream>
+
+#include "intcode.h"
+
+
+// Converts a comma-separated Intcode program into a binary image,
+// see save_intcode_image(), which load_intcode_image() can map
+// straight into memory without parsing.
+//
+// Usage: intcode_to_image.exe input.txt output.img
+
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " input.txt output.img" << std::endl;
+        return 1;
+    }
+    std::ifstream input_stream(argv[1]);
+    if (!input_stream) {
+        std::cerr << "File not found: " << argv[1] << std::endl;
+        return 1;
+    }
+    auto program = load_intcode_program(input_stream);
+    // Memory is padded out to whole pages, so trim the trailing zeros
+    auto num_cells = program.size();
+    while (num_cells > 0 && program.read(num_cells - 1) == 0) {
+        --num_cells;
+    }
+    std::ofstream output_stream(argv[2], std::ios::binary);
+    if (!output_stream) {
+        std::cerr << "Couldn't open " << argv[2] << " for writing" << std::endl;
+        return 1;
+    }
+    save_intcode_image(program, num_cells, output_stream);
+    return 0;
+}
@@ -1,10 +1,14 @@
-#include <cmath>
+#include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 
 #include "intcode.h"
+#include "utils.h"
 
 
 Opcode int_to_opcode(intcode_type integer) {
@@ -39,99 +43,719 @@ Opcode int_to_opcode(intcode_type integer) {
 }
 
 
+Mode int_to_mode(intcode_type digit) {
+    switch(digit) {
+        case 0:
+            return Mode::POSITIONAL;
+        case 1:
+            return Mode::IMMEDIATE;
+        case 2:
+            return Mode::RELATIVE;
+        default:
+            std::stringstream error_message;
+            error_message << "Unknown mode: " << digit;
+            throw std::invalid_argument(error_message.str());
+    }
+}
+
+
 std::vector<Mode> int_to_modes(intcode_type integer, int num_operands) {
     std::vector<Mode> result(num_operands, Mode::POSITIONAL);
     integer /= 100;     // Remove opcode (trailing two digits)
     for (auto place = 0; place < num_operands; place++) {
-        intcode_type digit = (integer / static_cast<intcode_type>(
-            std::round(std::pow(10, place)))) % 10;
-        switch(digit) {
-            case 0:
-                result[place] = Mode::POSITIONAL;
-                break;
-            case 1:
-                result[place] = Mode::IMMEDIATE;
-                break;
-            case 2:
-                result[place] = Mode::RELATIVE;
-                break;
-            default:
-                std::stringstream error_message;
-                error_message << "Unknown mode: " << digit;
-                throw std::invalid_argument(error_message.str());
-        }
+        result[place] = int_to_mode(integer % 10);
+        integer /= 10;
     }
     return result;
 }
 
 
-program_type load_intcode_program(std::istream &input_stream) {
-    program_type program;
-    std::string num_str;
-    intcode_type address = 0;
-    while (std::getline(input_stream, num_str, ',')) {
-        program[address] = std::stoll(num_str);
-        ++address;
+int num_operands(Opcode opcode) {
+    switch (opcode) {
+        case Opcode::ADD:
+        case Opcode::MULTIPLY:
+        case Opcode::LESS_THAN:
+        case Opcode::EQUALS:
+            return 3;
+        case Opcode::JUMP_TRUE:
+        case Opcode::JUMP_FALSE:
+            return 2;
+        case Opcode::INPUT:
+        case Opcode::OUTPUT:
+        case Opcode::REL_BASE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+
+IntcodeInstruction handler_instruction(std::uint16_t handler) {
+    if (handler == 0 || handler >= NUM_INSTRUCTION_HANDLERS) {
+        std::stringstream error_message;
+        error_message << "Not an instruction handler: " << handler;
+        throw std::invalid_argument(error_message.str());
+    }
+    auto slot = (handler - 1) / 27;
+    auto mode_digits = (handler - 1) % 27;
+    auto opcode = slot == 9 ? Opcode::END : static_cast<Opcode>(slot + 1);
+    return IntcodeInstruction{opcode,
+                              {static_cast<Mode>(mode_digits / 9),
+                               static_cast<Mode>(mode_digits / 3 % 3),
+                               static_cast<Mode>(mode_digits % 3)},
+                              handler};
+}
+
+
+IntcodeInstruction decode_instruction(intcode_type integer) {
+    IntcodeInstruction instruction{int_to_opcode(integer),
+                                   {Mode::POSITIONAL, Mode::POSITIONAL, Mode::POSITIONAL},
+                                   0};
+    // Only validate the modes of operands this opcode actually uses
+    auto mode_digits = integer / 100;
+    for (auto place = 0; place < num_operands(instruction.opcode); ++place) {
+        instruction.modes[place] = int_to_mode(mode_digits % 10);
+        mode_digits /= 10;
     }
-    return program;
+    instruction.handler = handler_index(instruction.opcode, instruction.modes);
+    return instruction;
+}
+
+
+[[noreturn]] void throw_index_error(intcode_type index) {
+    std::stringstream error_message;
+    error_message << "Index out of range: " << index;
+    throw std::out_of_range(error_message.str());
 }
 
 
 void check_index(intcode_type index) {
     if (index < 0) {
+        throw_index_error(index);
+    }
+}
+
+
+// The switch interpreter validates operand addresses and modes itself
+// unless built with INTCODE_UNCHECKED. Memory rejects negative addresses
+// on its slow paths either way, so unchecked builds stay memory safe:
+// they only lose the earlier, more specific errors. The threaded
+// interpreter only ever relies on memory's checks, and its handler table
+// has no entries for invalid modes, so this doesn't affect it.
+#ifdef INTCODE_UNCHECKED
+constexpr bool CHECKED = false;
+#else
+constexpr bool CHECKED = true;
+#endif
+
+
+void check_operand(intcode_type index) {
+    if (CHECKED) {
+        check_index(index);
+    }
+}
+
+
+IntcodeMemory::IntcodeMemory(): table(std::make_shared<PageTable>()) {}
+
+
+IntcodeMemory::IntcodeMemory(const IntcodeMemory &other): table(other.table) {
+    freeze();
+}
+
+
+IntcodeMemory &IntcodeMemory::operator=(const IntcodeMemory &other) {
+    table = other.table;
+    freeze();
+    return *this;
+}
+
+
+IntcodeMemory IntcodeMemory::from_storage(std::shared_ptr<const intcode_type> cells,
+                                          size_t num_cells) {
+    auto num_pages = (num_cells + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (num_pages > MAX_PAGES) {
         std::stringstream error_message;
-        error_message << "Index out of range: " << index;
+        error_message << "Too many cells to store in pages: " << num_cells;
         throw std::out_of_range(error_message.str());
     }
+    IntcodeMemory memory;
+    auto &table = *memory.table;
+    table.pages.resize(num_pages);
+    for (size_t page_num = 0; page_num < num_cells / PAGE_SIZE; ++page_num) {
+        // Never written through, since these aren't in own_pages
+        auto page = const_cast<intcode_type *>(cells.get() + page_num * PAGE_SIZE);
+        table.pages[page_num] = std::shared_ptr<Page>(cells, reinterpret_cast<Page *>(page));
+    }
+    // The storage ends partway through the last page, so copy it
+    auto remainder = num_cells % PAGE_SIZE;
+    if (remainder > 0) {
+        auto page = std::make_shared<Page>();
+        std::copy(cells.get() + num_cells - remainder, cells.get() + num_cells, page->begin());
+        table.pages.back() = page;
+        table.own_pages.resize(num_pages);
+        table.own_pages.back() = page.get();
+    }
+    return memory;
 }
 
 
-intcode_type run_intcode_program(program_type program,
+intcode_type IntcodeMemory::read_slow(intcode_type address) const {
+    check_index(address);
+    auto page_num = static_cast<size_t>(address) >> PAGE_BITS;
+    if (page_num < MAX_PAGES) {
+        // Page hasn't been allocated yet
+        return 0;
+    }
+    auto iter = table->far_cells.find(address);
+    return iter == table->far_cells.end() ? 0 : iter->second;
+}
+
+
+intcode_type &IntcodeMemory::allocate(intcode_type address) {
+    check_index(address);
+    if (table->frozen.load(std::memory_order_relaxed)) {
+        // Another copy may still refer to this table, so take a private
+        // copy. The pages themselves stay shared, so none of them are
+        // this table's own yet.
+        auto copy = std::make_shared<PageTable>();
+        copy->pages = table->pages;
+        copy->far_cells = table->far_cells;
+        table = std::move(copy);
+    }
+    auto page_num = static_cast<size_t>(address) >> PAGE_BITS;
+    if (page_num >= MAX_PAGES) {
+        return table->far_cells[address];
+    }
+    auto &pages = table->pages;
+    if (page_num >= pages.size()) {
+        pages.resize(page_num + 1);
+    }
+    auto &own_pages = table->own_pages;
+    if (page_num >= own_pages.size()) {
+        own_pages.resize(pages.size());
+    }
+    auto &page = pages[page_num];
+    if (!own_pages[page_num]) {
+        // Likewise for the page being written, if it exists
+        page = page ? std::make_shared<Page>(*page) : std::make_shared<Page>();
+        own_pages[page_num] = page.get();
+    }
+    return (*page)[static_cast<size_t>(address) & PAGE_MASK];
+}
+
+
+// Fills memory one page at a time, for a program whose cells
+// arrive in order starting from address 0
+class SequentialWriter {
+public:
+    explicit SequentialWriter(program_type &program): program(program) {}
+
+    void append(intcode_type value) {
+        if (address == page_end) {
+            next_page();
+        }
+        if (page) {
+            page[address & IntcodeMemory::PAGE_MASK] = value;
+        } else {
+            program[static_cast<intcode_type>(address)] = value;
+        }
+        ++address;
+    }
+
+private:
+    void next_page() {
+        page_end = address + IntcodeMemory::PAGE_SIZE;
+        if (address < IntcodeMemory::MAX_PAGES * IntcodeMemory::PAGE_SIZE) {
+            // Cells within a page are contiguous
+            page = &program[static_cast<intcode_type>(address)];
+        } else {
+            page = nullptr;
+        }
+    }
+
+    program_type &program;
+    size_t address = 0;
+    size_t page_end = 0;
+    intcode_type *page = nullptr;
+};
+
+
+bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+
+void throw_parse_error(size_t offset, const std::string &problem) {
+    std::stringstream error_message;
+    error_message << "Malformed Intcode program at byte " << offset << ": " << problem;
+    throw std::invalid_argument(error_message.str());
+}
+
+
+program_type parse_intcode_program(const char *text, size_t length) {
+    program_type program;
+    SequentialWriter writer(program);
+    const auto end = text + length;
+    auto position = text;
+    auto skip_spaces = [&]() -> void {
+        while (position != end && is_space(*position)) {
+            ++position;
+        }
+    };
+
+    skip_spaces();
+    if (position == end) {
+        return program;
+    }
+    while (true) {
+        auto start = position;
+        auto negative = false;
+        if (position != end && (*position == '-' || *position == '+')) {
+            negative = *position == '-';
+            ++position;
+        }
+        // Accumulate the magnitude unsigned so the most negative value fits
+        constexpr auto max_value = static_cast<unsigned long long>(
+            std::numeric_limits<intcode_type>::max());
+        const auto limit = max_value + (negative ? 1 : 0);
+        unsigned long long magnitude = 0;
+        auto digits_start = position;
+        while (position != end && *position >= '0' && *position <= '9') {
+            unsigned digit = static_cast<unsigned>(*position - '0');
+            if (magnitude > (limit - digit) / 10) {
+                throw_parse_error(static_cast<size_t>(start - text), "number out of range");
+            }
+            magnitude = magnitude * 10 + digit;
+            ++position;
+        }
+        if (position == digits_start) {
+            throw_parse_error(static_cast<size_t>(position - text), "expected a number");
+        }
+        writer.append(negative ? static_cast<intcode_type>(0 - magnitude)
+                               : static_cast<intcode_type>(magnitude));
+
+        skip_spaces();
+        if (position == end) {
+            return program;
+        }
+        if (*position != ',') {
+            throw_parse_error(static_cast<size_t>(position - text), "expected a comma");
+        }
+        ++position;
+        skip_spaces();
+        if (position == end) {
+            // A trailing comma is allowed, as the old stream loader did
+            return program;
+        }
+    }
+}
+
+
+program_type load_intcode_program(std::istream &input_stream) {
+    if (is_intcode_image(input_stream)) {
+        return read_intcode_image(input_stream);
+    }
+    // Read everything into one buffer, sized up front if the stream can seek
+    std::string text;
+    auto start = input_stream.tellg();
+    if (start != std::istream::pos_type(-1) && input_stream.seekg(0, std::ios::end)) {
+        auto length = input_stream.tellg() - start;
+        input_stream.seekg(start);
+        text.resize(static_cast<size_t>(length));
+        input_stream.read(&text[0], length);
+        text.resize(static_cast<size_t>(input_stream.gcount()));
+    } else {
+        input_stream.clear();
+        text.assign(std::istreambuf_iterator<char>(input_stream),
+                    std::istreambuf_iterator<char>());
+    }
+    return parse_intcode_program(text.data(), text.size());
+}
+
+
+intcode_type run_intcode_program(const program_type &program,
                                  std::istream &input,
                                  std::ostream &output) {
-    return run_intcode_program(
-        program,
-        [&input]() -> intcode_type {intcode_type val = -1; input >> val; return val;},
-        [&output](intcode_type val) -> void {output << val << ",";});
+    auto read_value = [&input]() -> intcode_type {intcode_type val = -1; input >> val; return val;};
+    auto write_value = [&output](intcode_type val) -> void {output << val << ",";};
+    IntcodeCallbacks<decltype(read_value), decltype(write_value)> io{read_value, write_value};
+    return run_intcode_io(program, io);
 }
 
 
-intcode_type run_intcode_program(program_type program,
+constexpr size_t MAX_DECODE_CACHE_SIZE = IntcodeMemory::PAGE_SIZE * 64;
+
+
+intcode_type run_intcode_program(const program_type &program,
                                  std::function<intcode_type()> input,
                                  std::function<void(intcode_type)> output) {
-    auto pc = 0, relative_base = 0;
-    bool done = false;
-    while (!done) {
-        auto opcode = int_to_opcode(program[pc]);
+    return run_intcode_program(program, std::move(input), std::move(output), StopToken());
+}
+
+
+intcode_type run_intcode_program(const program_type &program,
+                                 std::function<intcode_type()> input,
+                                 std::function<void(intcode_type)> output,
+                                 const StopToken &stop_token) {
+    IntcodeCallbacks<std::function<intcode_type()>, std::function<void(intcode_type)> > io{
+        std::move(input), std::move(output)};
+    return run_intcode_io(program, io, stop_token);
+}
+
+
+std::vector<std::vector<intcode_type> > run_intcode_batch(
+        const IntcodeMachine &start,
+        const std::vector<std::vector<intcode_type> > &inputs) {
+    std::vector<std::vector<intcode_type> > outputs(inputs.size());
+    // Forks only share memory pages until they write to them,
+    // so the runs don't interfere with each other or with start
+    parallel_for(inputs.size(), [&](size_t i) -> void {
+        auto machine = start.fork();
+        for (auto value: inputs[i]) {
+            machine.feed(value);
+        }
+        machine.run_until_input_needed();
+        outputs[i] = machine.take_outputs();
+    });
+    return outputs;
+}
+
+
+IntcodeMachine::IntcodeMachine(program_type program): memory(std::move(program)) {}
+
+
+IntcodeMachine::IntcodeMachine(const IntcodeImage &image):
+        memory(image.program),
+        image_handlers(image.handlers),
+        image_cells(image.handlers ? image.num_cells : 0),
+        image_program(image.program) {}
+
+
+void IntcodeMachine::feed(intcode_type value) {
+    inputs.push_back(value);
+    changed_since_poll = true;
+    idle_polls = 0;
+}
+
+
+void IntcodeMachine::feed(std::initializer_list<intcode_type> values) {
+    inputs.insert(inputs.end(), values);
+    changed_since_poll = true;
+    idle_polls = 0;
+}
+
+
+IntcodeMachine::State IntcodeMachine::run_until_input_needed() {
+    return run(false);
+}
+
+
+IntcodeMachine::State IntcodeMachine::run_until_output() {
+    return run(true);
+}
+
+
+intcode_type IntcodeMachine::take_output() {
+    if (outputs.empty()) {
+        throw std::logic_error("No output available");
+    }
+    auto value = outputs.front();
+    outputs.pop_front();
+    // The output may have been produced since the last poll
+    changed_since_poll = true;
+    idle_polls = 0;
+    return value;
+}
+
+
+std::vector<intcode_type> IntcodeMachine::take_outputs() {
+    std::vector<intcode_type> values(outputs.begin(), outputs.end());
+    outputs.clear();
+    if (!values.empty()) {
+        changed_since_poll = true;
+        idle_polls = 0;
+    }
+    return values;
+}
+
+
+// Called after writing to an address that might hold an instruction
+void IntcodeMachine::invalidate_code(intcode_type address) {
+    // Invalidate the decoded instruction in case the program
+    // is modifying its own code
+    if (static_cast<size_t>(address) < code.instructions.size()) {
+        code.instructions[address] = IntcodeInstruction{};
+        if (code.fused_cells[address]) {
+            unfuse_around(address);
+        }
+    }
+    // Likewise, native code is only valid while its instructions are intact
+    if (native_program && native_program->is_code(address)) {
+        native_program = nullptr;
+    }
+}
+
+
+bool IntcodeMachine::set_native_program(const NativeProgram *program) {
+    for (size_t address = 0; address < program->size; ++address) {
+        if (program->code_cells[address]
+                && memory.read(address) != program->image[address]) {
+            return false;
+        }
+    }
+    native_program = program;
+    return true;
+}
+
+
+void IntcodeMachine::grow_decode_cache(size_t size) {
+    code.instructions.resize(size);
+    code.block_heat.resize(size);
+    code.fused_cells.resize(size);
+}
+
+
+IntcodeInstruction IntcodeMachine::fetch(intcode_type address) {
+    if (static_cast<size_t>(address) >= MAX_DECODE_CACHE_SIZE) {
+        // Far away (or negative) addresses aren't worth caching
+        return decode(address);
+    }
+    if (static_cast<size_t>(address) >= code.instructions.size()) {
+        grow_decode_cache(address + 1);
+    }
+    auto &cached = code.instructions[address];
+    if (!cached.is_decoded()) {
+        cached = decode(address);
+    }
+    return cached;
+}
+
+
+// The integer an instruction is usually written as,
+// with zeros for the modes of any unused operands
+intcode_type encode_instruction(const IntcodeInstruction &instruction) {
+    return static_cast<intcode_type>(instruction.opcode)
+        + 100 * static_cast<intcode_type>(instruction.modes[0])
+        + 1000 * static_cast<intcode_type>(instruction.modes[1])
+        + 10000 * static_cast<intcode_type>(instruction.modes[2]);
+}
+
+
+// Decode the cell at address, using the image's decoded instruction
+// table where it has an entry. The table drives dispatch directly, so
+// each entry is checked against the cell before it's trusted.
+IntcodeInstruction IntcodeMachine::decode(intcode_type address) {
+    auto value = memory.read(address);
+    if (static_cast<size_t>(address) >= image_cells) {
+        return decode_instruction(value);
+    }
+    auto handler = image_handlers.get()[address];
+    if (handler == 0) {
+        // Data, or at least not an instruction when the image was saved
+        return decode_instruction(value);
+    }
+    if (handler < NUM_INSTRUCTION_HANDLERS) {
+        auto instruction = handler_instruction(handler);
+        if (encode_instruction(instruction) == value) {
+            return instruction;
+        }
+    }
+    // The cell may have been overwritten since the image was saved, or
+    // have digits for unused modes. Otherwise the table must be corrupt.
+    if (value == image_program.read(address)) {
+        auto valid = false;
+        try {
+            valid = decode_instruction(value).handler == handler;
+        } catch (const std::invalid_argument &) {
+            // Not an instruction at all
+        }
+        if (!valid) {
+            std::stringstream error_message;
+            error_message << "Corrupt decoded instruction at cell " << address;
+            error_message << " of Intcode image";
+            throw std::runtime_error(error_message.str());
+        }
+    }
+    return decode_instruction(value);
+}
+
+
+// Longest distance from the start of a fused pair
+// to a cell its fusion depends on
+constexpr intcode_type MAX_FUSED_DEPENDENCY = 5;
+// Limit on how many instructions are examined per block
+constexpr int MAX_FUSED_BLOCK_LENGTH = 64;
+
+
+// Replace common instruction pairs in the block starting at address
+// with superinstructions. See compare_branch_index() and
+// rel_base_jump_index() for the pairs that are recognized.
+void IntcodeMachine::fuse_block(intcode_type address) {
+    if (!fusion_enabled) {
+        return;
+    }
+    for (auto count = 0; count < MAX_FUSED_BLOCK_LENGTH; ++count) {
+        if (address < 0 || static_cast<size_t>(address) + 7 >= MAX_DECODE_CACHE_SIZE) {
+            return;
+        }
+        IntcodeInstruction first, second;
+        auto next = address;
+        try {
+            first = fetch(address);
+            if (first.opcode == Opcode::JUMP_TRUE || first.opcode == Opcode::JUMP_FALSE
+                    || first.opcode == Opcode::END) {
+                // End of the block
+                return;
+            }
+            next = address + num_operands(first.opcode) + 1;
+            second = fetch(next);
+        } catch (const std::invalid_argument &) {
+            // Not an instruction, so the block must end before this
+            return;
+        }
+        // Cells the fusion depends on, besides the first instruction itself
+        std::vector<intcode_type> dependencies;
+        bool is_jump = second.opcode == Opcode::JUMP_TRUE || second.opcode == Opcode::JUMP_FALSE;
+        if ((first.opcode == Opcode::LESS_THAN || first.opcode == Opcode::EQUALS)
+                && first.modes[2] != Mode::IMMEDIATE && is_jump
+                && second.modes[0] == first.modes[2]
+                && second.modes[1] == Mode::IMMEDIATE
+                && memory.read(address + 3) == memory.read(next + 1)) {
+            code.instructions[address].handler = compare_branch_index(
+                first.opcode, second.opcode, first.modes);
+            dependencies = {address + 3, next, next + 1};
+        } else if (first.opcode == Opcode::REL_BASE && first.modes[0] == Mode::IMMEDIATE
+                   && is_jump) {
+            code.instructions[address].handler = rel_base_jump_index(
+                second.opcode, second.modes[0], second.modes[1]);
+            dependencies = {next};
+        }
+        for (auto dependency: dependencies) {
+            if (static_cast<size_t>(dependency) >= code.instructions.size()) {
+                grow_decode_cache(dependency + 1);
+            }
+            code.fused_cells[dependency] = true;
+        }
+        address = next;
+    }
+}
+
+
+// Revert fused pairs that might depend on the cell at address.
+// Marks in fused_cells are left behind, which only costs an extra
+// scan if the cell is written again.
+void IntcodeMachine::unfuse_around(intcode_type address) {
+    for (auto start = address - 1;
+         start >= 0 && start >= address - MAX_FUSED_DEPENDENCY;
+         --start) {
+        auto &instruction = code.instructions[start];
+        if (instruction.is_decoded() && instruction.is_fused()) {
+            instruction.handler = handler_index(instruction.opcode, instruction.modes);
+        }
+    }
+}
+
+
+// Stand-in for IntcodeProfile in unprofiled runs, which compiles away
+struct NoProfile {
+    void count_instruction(intcode_type, const IntcodeInstruction &) {}
+    void count_input() {}
+    void count_output() {}
+    void count_write(intcode_type) {}
+};
+
+
+IntcodeMachine::State IntcodeMachine::run(bool stop_on_output) {
+    while (true) {
+        auto result = run_engine(stop_on_output);
+        if (result != State::NEEDS_INPUT || !has_default_input) {
+            return result;
+        }
+        if (!changed_since_poll && pc == poll_pc && relative_base == poll_relative_base
+                && outputs.size() == poll_outputs) {
+            // Back where the last poll left off, with nothing changed in
+            // between, so polling again would just repeat the same loop
+            return result;
+        }
+        if (outputs.size() != poll_outputs) {
+            idle_polls = 0;
+        } else if (idle_polls == MAX_IDLE_POLLS) {
+            // Memory keeps changing, but nothing comes of it
+            return result;
+        }
+        ++idle_polls;
+        poll_pc = pc;
+        poll_relative_base = relative_base;
+        poll_outputs = outputs.size();
+        changed_since_poll = false;
+        inputs.push_back(default_input);
+    }
+}
+
+
+IntcodeMachine::State IntcodeMachine::run_engine(bool stop_on_output) {
+    if (profile) {
+        auto result = run_switch(stop_on_output, *profile);
+        profile->note_memory_size(memory.size());
+        return result;
+    }
+    if (native_program) {
+        NativeState native_state{*this, pc, relative_base, inputs, outputs,
+                                 stop_token, stop_on_output};
+        auto result = native_program->run(native_state);
+        if (result != State::READY) {
+            state = result;
+            return state;
+        }
+        // The native code reached something it can't handle,
+        // such as self-modified code, so interpret from here
+    }
+#if INTCODE_HAS_COMPUTED_GOTO
+    if (dispatch == Dispatch::THREADED) {
+        return run_threaded(stop_on_output);
+    }
+#endif
+    NoProfile no_profile;
+    return run_switch(stop_on_output, no_profile);
+}
+
+
+template <typename Profile>
+IntcodeMachine::State IntcodeMachine::run_switch(bool stop_on_output, Profile &profile) {
+    while (true) {
+        auto instruction = fetch(pc);
+        profile.count_instruction(pc, instruction);
+        auto opcode = instruction.opcode;
+        const auto &modes = instruction.modes;
         switch (opcode) {
             case Opcode::END:
-                done = true;
-                break;
+                state = State::HALTED;
+                return state;
             case Opcode::INPUT:
             case Opcode::OUTPUT:
             case Opcode::REL_BASE: {
                 int num_operands = 1;
-                auto modes = int_to_modes(program[pc], num_operands);
-                if (opcode == Opcode::INPUT && modes[0] != Mode::POSITIONAL
+                if (CHECKED && opcode == Opcode::INPUT && modes[0] != Mode::POSITIONAL
                     && modes[0] != Mode::RELATIVE) {
                     std::stringstream error_message;
                     error_message << "Opcode " << static_cast<int>(opcode);
                     error_message << " expects positional operand mode";
                     throw std::logic_error(error_message.str());
                 }
-                auto parameter = program[pc+1];
+                auto parameter = memory.read(pc+1);
                 intcode_type value;
                 switch (modes[0]) {
                     case Mode::POSITIONAL:
-                        check_index(parameter);
-                        value = program[parameter];
+                        check_operand(parameter);
+                        value = memory.read(parameter);
                         break;
                     case Mode::IMMEDIATE:
                         value = parameter;
                         break;
                     case Mode::RELATIVE:
-                        check_index(relative_base + parameter);
-                        value = program[relative_base + parameter];
+                        check_operand(relative_base + parameter);
+                        value = memory.read(relative_base + parameter);
                         break;
                     default:
                         std::stringstream error_message;
@@ -140,21 +764,36 @@ intcode_type run_intcode_program(program_type program,
                 }
                 switch (opcode) {
                     case Opcode::INPUT:
+                        if (stop_token.stop_requested()) {
+                            state = State::STOPPED;
+                            return state;
+                        }
+                        if (inputs.empty()) {
+                            // Leave pc pointing at this instruction
+                            // so it's retried once input is fed
+                            state = State::NEEDS_INPUT;
+                            return state;
+                        }
                         switch (modes[0]) {
                             case Mode::POSITIONAL:
-                                program[parameter] = input();
+                                profile.count_write(parameter);
+                                write(parameter, inputs.front());
                                 break;
                             case Mode::RELATIVE:
-                                program[relative_base + parameter] = input();
+                                profile.count_write(relative_base + parameter);
+                                write(relative_base + parameter, inputs.front());
                                 break;
                             default:
                                 std::stringstream error_message;
                                 error_message << "Unexpected mode: " << static_cast<int>(modes[0]);
                                 throw std::logic_error(error_message.str());
                         }
+                        inputs.pop_front();
+                        profile.count_input();
                         break;
                     case Opcode::OUTPUT:
-                        output(value);
+                        outputs.push_back(value);
+                        profile.count_output();
                         break;
                     case Opcode::REL_BASE:
                         relative_base += value;
@@ -165,25 +804,34 @@ intcode_type run_intcode_program(program_type program,
                         throw std::logic_error(error_message.str());
                 }
                 pc += num_operands + 1;
+                if (opcode == Opcode::OUTPUT && stop_on_output) {
+                    state = State::HAS_OUTPUT;
+                    return state;
+                }
                 break;
             }
             case Opcode::JUMP_TRUE:
             case Opcode::JUMP_FALSE: {
+                // Every loop passes through a jump, so checking here
+                // is enough to interrupt long computations
+                if (stop_token.stop_requested()) {
+                    state = State::STOPPED;
+                    return state;
+                }
                 int num_operands = 2;
-                auto modes = int_to_modes(program[pc], num_operands);
                 bool condition = false;
                 intcode_type destination = -1;
                 switch (modes[0]) {
                     case Mode::POSITIONAL:
-                        check_index(program[pc+1]);
-                        condition = static_cast<bool>(program[program[pc+1]]);
+                        check_operand(memory.read(pc+1));
+                        condition = static_cast<bool>(memory.read(memory.read(pc+1)));
                         break;
                     case Mode::IMMEDIATE:
-                        condition = static_cast<bool>(program[pc+1]);
+                        condition = static_cast<bool>(memory.read(pc+1));
                         break;
                     case Mode::RELATIVE:
-                        check_index(relative_base + program[pc+1]);
-                        condition = static_cast<bool>(program[relative_base + program[pc+1]]);
+                        check_operand(relative_base + memory.read(pc+1));
+                        condition = static_cast<bool>(memory.read(relative_base + memory.read(pc+1)));
                         break;
                     default:
                         std::stringstream error_message;
@@ -192,15 +840,15 @@ intcode_type run_intcode_program(program_type program,
                 }
                 switch (modes[1]) {
                     case Mode::POSITIONAL:
-                        check_index(program[pc+2]);
-                        destination = program[program[pc+2]];
+                        check_operand(memory.read(pc+2));
+                        destination = memory.read(memory.read(pc+2));
                         break;
                     case Mode::IMMEDIATE:
-                        destination = program[pc+2];
+                        destination = memory.read(pc+2);
                         break;
                     case Mode::RELATIVE:
-                        check_index(relative_base + program[pc+2]);
-                        destination = program[relative_base + program[pc+2]];
+                        check_operand(relative_base + memory.read(pc+2));
+                        destination = memory.read(relative_base + memory.read(pc+2));
                         break;
                     default:
                         std::stringstream error_message;
@@ -226,19 +874,18 @@ intcode_type run_intcode_program(program_type program,
             case Opcode::LESS_THAN:
             case Opcode::EQUALS: {
                 int num_operands = 3;
-                auto modes = int_to_modes(program[pc], num_operands);
-                intcode_type input_a = -1, input_b = -1, output_index;
+                intcode_type input_a = -1, input_b = -1, output_index = -1;
                 switch (modes[0]) {
                     case Mode::POSITIONAL:
-                        check_index(program[pc+1]);
-                        input_a = program[program[pc+1]];
+                        check_operand(memory.read(pc+1));
+                        input_a = memory.read(memory.read(pc+1));
                         break;
                     case Mode::IMMEDIATE:
-                        input_a = program[pc+1];
+                        input_a = memory.read(pc+1);
                         break;
                     case Mode::RELATIVE:
-                        check_index(relative_base + program[pc+1]);
-                        input_a = program[relative_base + program[pc+1]];
+                        check_operand(relative_base + memory.read(pc+1));
+                        input_a = memory.read(relative_base + memory.read(pc+1));
                         break;
                     default:
                         std::stringstream error_message;
@@ -247,15 +894,15 @@ intcode_type run_intcode_program(program_type program,
                 }
                 switch (modes[1]) {
                     case Mode::POSITIONAL:
-                        check_index(program[pc+2]);
-                        input_b = program[program[pc+2]];
+                        check_operand(memory.read(pc+2));
+                        input_b = memory.read(memory.read(pc+2));
                         break;
                     case Mode::IMMEDIATE:
-                        input_b = program[pc+2];
+                        input_b = memory.read(pc+2);
                         break;
                     case Mode::RELATIVE:
-                        check_index(relative_base + program[pc+2]);
-                        input_b = program[relative_base + program[pc+2]];
+                        check_operand(relative_base + memory.read(pc+2));
+                        input_b = memory.read(relative_base + memory.read(pc+2));
                         break;
                     default:
                         std::stringstream error_message;
@@ -264,19 +911,23 @@ intcode_type run_intcode_program(program_type program,
                 }
                 switch (modes[2]) {
                     case Mode::POSITIONAL:
-                        output_index = program[pc+3];
-                        check_index(output_index);
+                        output_index = memory.read(pc+3);
+                        check_operand(output_index);
                         break;
                     case Mode::RELATIVE:
-                        output_index = relative_base + program[pc+3];
-                        check_index(output_index);
+                        output_index = relative_base + memory.read(pc+3);
+                        check_operand(output_index);
                         break;
                     default:
-                        std::stringstream error_message;
-                        error_message << "Opcode " << static_cast<int>(opcode);
-                        error_message << " expects positional or relative mode";
-                        error_message << " for final operand";
-                        std::logic_error(error_message.str());
+                        if (CHECKED) {
+                            std::stringstream error_message;
+                            error_message << "Opcode " << static_cast<int>(opcode);
+                            error_message << " expects positional or relative mode";
+                            error_message << " for final operand";
+                            throw std::logic_error(error_message.str());
+                        }
+                        // Otherwise output_index stays negative,
+                        // which memory rejects when it's written
                 }
                 intcode_type result = -1;
                 switch (opcode) {
@@ -297,7 +948,8 @@ intcode_type run_intcode_program(program_type program,
                         error_message << "Unexpected opcode: " << static_cast<int>(opcode);
                         throw std::logic_error(error_message.str());
                 }
-                program[output_index] = result;
+                profile.count_write(output_index);
+                write(output_index, result);
                 pc += num_operands + 1;
                 break;
             }
@@ -307,5 +959,4 @@ intcode_type run_intcode_program(program_type program,
                 throw std::logic_error(error_message.str());
         }
     }
-    return program[0];
 }
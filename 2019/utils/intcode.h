@@ -1,14 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
 #include <functional>
+#include <initializer_list>
+#include <iostream>
 #include <istream>
+#include <memory>
+#include <mutex>
 #include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
+#include "utils.h"
+
+
+// Computed goto is a GCC extension, also supported by Clang
+#if defined(__GNUC__) && !defined(INTCODE_NO_COMPUTED_GOTO)
+#define INTCODE_HAS_COMPUTED_GOTO 1
+#else
+#define INTCODE_HAS_COMPUTED_GOTO 0
+#endif
+
 
 using intcode_type = long long;
-using program_type = std::unordered_map<intcode_type, intcode_type>;
 
-enum class Opcode {
+
+// Zero-initialized memory with an unbounded, non-negative address space.
+// Cells are grouped into fixed-size pages which are allocated on first write,
+// so the common case is a plain array index. Addresses beyond the paged range
+// fall back to a sparse map.
+//
+// Copies share everything until they're written to: first the table of
+// pages, then each individual page. Copying is therefore O(1), and a
+// program image can back any number of machines, each of which only
+// holds its own copies of the pages it has modified.
+//
+// Once a table has been copied it's never modified again, and a page is
+// only written in place by the table which allocated it. So nothing that
+// another copy, possibly on another thread, could be reading is written.
+// Reference counts can't decide this: use_count() is a relaxed load, so
+// seeing the other copies gone doesn't order their reads before a write.
+class IntcodeMemory {
+public:
+    static constexpr size_t PAGE_BITS = 10;
+    static constexpr size_t PAGE_SIZE = size_t{1} << PAGE_BITS;
+    static constexpr size_t PAGE_MASK = PAGE_SIZE - 1;
+    static constexpr size_t MAX_PAGES = size_t{1} << 14;
+
+    IntcodeMemory();
+    IntcodeMemory(const IntcodeMemory &other);
+    IntcodeMemory(IntcodeMemory &&other) = default;
+    IntcodeMemory &operator=(const IntcodeMemory &other);
+    IntcodeMemory &operator=(IntcodeMemory &&other) = default;
+
+    // Memory whose first num_cells cells are backed by existing storage,
+    // such as a memory-mapped file. The storage is never written to:
+    // pages are copied before they're modified.
+    static IntcodeMemory from_storage(std::shared_ptr<const intcode_type> cells,
+                                      size_t num_cells);
+
+    // Reading never allocates. Untouched cells read as zero.
+    intcode_type read(intcode_type address) const {
+        auto page_num = static_cast<size_t>(address) >> PAGE_BITS;
+        const auto &pages = table->pages;
+        if (page_num < pages.size() && pages[page_num]) {
+            return (*pages[page_num])[static_cast<size_t>(address) & PAGE_MASK];
+        }
+        return read_slow(address);
+    }
+
+    // Return a reference to a cell, allocating its page if necessary,
+    // or copying it if it might be shared with another IntcodeMemory
+    intcode_type &operator[](intcode_type address) {
+        auto page_num = static_cast<size_t>(address) >> PAGE_BITS;
+        if (!table->frozen.load(std::memory_order_relaxed)) {
+            const auto &own_pages = table->own_pages;
+            if (page_num < own_pages.size() && own_pages[page_num]) {
+                return (*own_pages[page_num])[static_cast<size_t>(address) & PAGE_MASK];
+            }
+        }
+        return allocate(address);
+    }
+
+    // One past the highest paged address that has been allocated. Every
+    // cell beyond it, other than those past the paged range, reads as zero.
+    size_t size() const {
+        return table->pages.size() * PAGE_SIZE;
+    }
+
+private:
+    using Page = std::array<intcode_type, PAGE_SIZE>;
+
+    struct PageTable {
+        // A null page has not been allocated yet
+        std::vector<std::shared_ptr<Page> > pages;
+        // The pages this table allocated itself, which no other table
+        // refers to, or null. May be shorter than pages.
+        std::vector<Page *> own_pages;
+        std::unordered_map<intcode_type, intcode_type> far_cells;
+        // Set once an IntcodeMemory holding this table is copied. Only
+        // ever set by a thread that can also read the table, and seen by
+        // every other holder, since the copy must reach them somehow.
+        std::atomic<bool> frozen{false};
+    };
+
+    void freeze() const {
+        table->frozen.store(true, std::memory_order_relaxed);
+    }
+
+    intcode_type read_slow(intcode_type address) const;
+    intcode_type &allocate(intcode_type address);
+
+    // Never null
+    std::shared_ptr<PageTable> table;
+};
+
+using program_type = IntcodeMemory;
+
+enum class Opcode : std::uint8_t {
     ADD = 1,
     MULTIPLY = 2,
     INPUT = 3,
@@ -23,7 +144,7 @@ enum class Opcode {
 
 Opcode int_to_opcode(intcode_type integer);
 
-enum class Mode {
+enum class Mode : std::uint8_t {
     POSITIONAL = 0,
     IMMEDIATE = 1,
     RELATIVE = 2
@@ -32,13 +153,811 @@ enum class Mode {
 std::vector<Mode> int_to_modes(intcode_type integer, int num_operands);
 
 
+// Number of specialized handlers a dispatch engine can choose between
+// for a single instruction: every opcode combined with every mode of up
+// to three operands, plus index zero, which is reserved for undecoded
+// instructions.
+constexpr size_t NUM_INSTRUCTION_HANDLERS = 1 + 10 * 27;
+
+constexpr std::uint16_t handler_index(Opcode opcode, const std::array<Mode, 3> &modes) {
+    // END is the only opcode outside of 1-9
+    auto slot = opcode == Opcode::END ? 9 : static_cast<int>(opcode) - 1;
+    return static_cast<std::uint16_t>(1 + slot * 27
+                                      + static_cast<int>(modes[0]) * 9
+                                      + static_cast<int>(modes[1]) * 3
+                                      + static_cast<int>(modes[2]));
+}
+
+// Superinstructions execute a common pair of instructions with a single
+// dispatch. Their handlers are numbered after the single instructions.
+//
+// Compare and branch: LESS_THAN or EQUALS followed by JUMP_TRUE or
+// JUMP_FALSE on the cell it just wrote, with an immediate destination.
+// The modes are those of the comparison.
+constexpr size_t NUM_COMPARE_BRANCH_HANDLERS = 2 * 2 * 27;
+
+constexpr std::uint16_t compare_branch_index(Opcode compare, Opcode jump,
+                                             const std::array<Mode, 3> &modes) {
+    auto slot = (compare == Opcode::LESS_THAN ? 0 : 2)
+                + (jump == Opcode::JUMP_TRUE ? 0 : 1);
+    return static_cast<std::uint16_t>(NUM_INSTRUCTION_HANDLERS + slot * 27
+                                      + static_cast<int>(modes[0]) * 9
+                                      + static_cast<int>(modes[1]) * 3
+                                      + static_cast<int>(modes[2]));
+}
+
+// Stack frame adjustment and jump: REL_BASE with an immediate operand
+// followed by JUMP_TRUE or JUMP_FALSE, as in a function return.
+// The modes are those of the jump.
+constexpr size_t NUM_REL_BASE_JUMP_HANDLERS = 2 * 9;
+
+constexpr std::uint16_t rel_base_jump_index(Opcode jump, Mode condition, Mode destination) {
+    auto slot = jump == Opcode::JUMP_TRUE ? 0 : 1;
+    return static_cast<std::uint16_t>(NUM_INSTRUCTION_HANDLERS
+                                      + NUM_COMPARE_BRANCH_HANDLERS + slot * 9
+                                      + static_cast<int>(condition) * 3
+                                      + static_cast<int>(destination));
+}
+
+constexpr size_t NUM_HANDLER_INDICES = NUM_INSTRUCTION_HANDLERS
+                                       + NUM_COMPARE_BRANCH_HANDLERS
+                                       + NUM_REL_BASE_JUMP_HANDLERS;
+
+
+// Compact decoded form of an instruction's opcode and operand modes.
+// A value-initialized IntcodeInstruction (opcode 0) marks an undecoded
+// cache entry.
+struct IntcodeInstruction {
+    Opcode opcode;
+    std::array<Mode, 3> modes;
+    // See handler_index(). May be replaced by a superinstruction handler
+    // covering this instruction and the next.
+    std::uint16_t handler;
+
+    bool is_decoded() const {
+        return opcode != Opcode{};
+    }
+
+    bool is_fused() const {
+        return handler >= NUM_INSTRUCTION_HANDLERS;
+    }
+};
+
+int num_operands(Opcode opcode);
+
+IntcodeInstruction decode_instruction(intcode_type integer);
+
+// Inverse of handler_index(), for indices of single instructions
+IntcodeInstruction handler_instruction(std::uint16_t handler);
+
+
+// Accepts either comma-separated text or a binary image
+// written by save_intcode_image()
 program_type load_intcode_program(std::istream &input_stream);
+// Likewise for a file, which is mapped into memory if it's large enough
+// for that to pay off. An image's cells are then used in place, as with
+// load_intcode_image(), rather than copied.
+program_type load_intcode_program(const std::string &filename);
+
+// Parses comma-separated text in place, allowing whitespace around each
+// number and a trailing comma. Throws std::invalid_argument giving the
+// byte offset of the first problem if the text is malformed.
+program_type parse_intcode_program(const char *text, size_t length);
 
 
-intcode_type run_intcode_program(program_type program,
+// A program loaded from a binary image file
+struct IntcodeImage {
+    program_type program;
+    size_t num_cells;
+    // Handler index of each cell, see handler_index(), or 0 if the cell
+    // doesn't hold a valid instruction. Null if the image has no table.
+    std::shared_ptr<const std::uint16_t> handlers;
+};
+
+// Binary image format, with all values little-endian:
+//   8 bytes  magic, "ICIMAGE" and a null byte
+//   4 bytes  format version
+//   4 bytes  flags, bit 0 set if a decoded instruction table is included
+//   8 bytes  number of cells
+//   8 bytes  per cell
+//   2 bytes  per cell for the decoded instruction table, if included
+// The decoded table depends on the numbering of handlers, so the version
+// changes whenever it does.
+//
+// The first num_cells cells of program are saved. Far cells aren't.
+void save_intcode_image(const program_type &program, size_t num_cells,
+                        std::ostream &output, bool include_handlers = true);
+
+// Memory-maps the file, unless it holds less than a page of cells, which
+// would be copied anyway. Program memory refers to the mapped cells
+// directly, copying each page only when it's first written to.
+// The decoded instruction table isn't checked against the cells until
+// an IntcodeMachine runs them.
+IntcodeImage load_intcode_image(const std::string &filename);
+
+// Whether a stream holds a binary image, without consuming anything
+bool is_intcode_image(std::istream &input_stream);
+// Read a binary image from a stream, copying its cells.
+// Any decoded instruction table is skipped.
+program_type read_intcode_image(std::istream &input_stream);
+
+
+intcode_type run_intcode_program(const program_type &program,
                                  std::istream &input = std::cin,
                                  std::ostream &output = std::cout);
 
-intcode_type run_intcode_program(program_type program,
+
+// Instruction counts gathered while an IntcodeMachine runs,
+// see IntcodeMachine::set_profile()
+class IntcodeProfile {
+public:
+    void count_instruction(intcode_type address, const IntcodeInstruction &instruction) {
+        auto handler = handler_index(instruction.opcode, instruction.modes);
+        ++handler_counts[handler];
+        if (static_cast<size_t>(address) >= MAX_PROFILED_ADDRESS) {
+            ++far_instructions;
+            return;
+        }
+        if (static_cast<size_t>(address) >= address_counts.size()) {
+            address_counts.resize(address + 1);
+            address_handlers.resize(address + 1);
+        }
+        ++address_counts[address];
+        address_handlers[address] = handler;
+    }
+    void count_input() {
+        ++inputs;
+    }
+    void count_output() {
+        ++outputs;
+    }
+    void count_write(intcode_type address) {
+        highest_write = std::max(highest_write, address);
+    }
+    void note_memory_size(size_t size) {
+        allocated_cells = std::max(allocated_cells, size);
+    }
+
+    std::uint64_t total_instructions() const;
+
+    // Summary of the hottest addresses and opcode/mode combinations,
+    // along with I/O and memory totals
+    void report(std::ostream &output, size_t max_rows = 20) const;
+
+private:
+    // Instructions beyond this address are only counted in total
+    static constexpr size_t MAX_PROFILED_ADDRESS = size_t{1} << 20;
+
+    std::vector<std::uint64_t> address_counts;
+    // The most recent instruction executed at each address
+    std::vector<std::uint16_t> address_handlers;
+    std::array<std::uint64_t, NUM_INSTRUCTION_HANDLERS> handler_counts{};
+    std::uint64_t far_instructions = 0;
+    std::uint64_t inputs = 0, outputs = 0;
+    intcode_type highest_write = -1;
+    size_t allocated_cells = 0;
+};
+
+
+// These wrap the templated run_intcode_program() below, for callers that
+// need to store or pass around their callbacks
+intcode_type run_intcode_program(const program_type &program,
                                  std::function<intcode_type()> input,
                                  std::function<void(intcode_type)> output);
+
+// Stops early, without calling input or output again, once stop_token
+// is triggered. The input callback can trigger it itself to halt the
+// program, in which case the value it returns is ignored.
+intcode_type run_intcode_program(const program_type &program,
+                                 std::function<intcode_type()> input,
+                                 std::function<void(intcode_type)> output,
+                                 const StopToken &stop_token);
+
+
+// An Intcode computer that owns its memory, program counter and relative
+// base. Instead of blocking on I/O callbacks, it pauses whenever it needs
+// input (or, optionally, produces output), so many machines can be driven
+// cooperatively from a single thread.
+class IntcodeMachine {
+public:
+    enum class State {
+        READY,
+        NEEDS_INPUT,
+        HAS_OUTPUT,
+        HALTED,
+        STOPPED
+    };
+
+    // How instructions are dispatched. THREADED jumps straight to a handler
+    // specialized for each opcode and mode combination. It needs computed
+    // goto, and falls back to the portable SWITCH loop when unavailable.
+    enum class Dispatch {
+        SWITCH,
+        THREADED
+    };
+
+    // Interface to code generated ahead of time by tools/intcode_to_cpp.
+    // Native code runs with direct access to the machine's registers and
+    // I/O queues, and returns READY to hand control back to the interpreter.
+    struct NativeState {
+        IntcodeMachine &machine;
+        intcode_type &pc;
+        intcode_type &relative_base;
+        std::deque<intcode_type> &inputs;
+        std::deque<intcode_type> &outputs;
+        const StopToken &stop_token;
+        bool stop_on_output;
+    };
+
+    struct NativeProgram {
+        State (*run)(NativeState &state);
+        // Contents of memory the code was compiled from, and which
+        // of those cells hold instructions. Both have size entries.
+        const intcode_type *image;
+        const unsigned char *code_cells;
+        size_t size;
+
+        bool is_code(intcode_type address) const {
+            return static_cast<size_t>(address) < size && code_cells[address];
+        }
+    };
+
+    explicit IntcodeMachine(program_type program);
+    // Takes instructions from the image's decoded instruction table, if
+    // any, instead of decoding them. Each entry is checked the first time
+    // it's used, and a run throws std::runtime_error if it's corrupt.
+    explicit IntcodeMachine(const IntcodeImage &image);
+
+    // Independent copy of the machine's memory, registers and queues.
+    // Memory pages are shared until written, and decoded instructions
+    // aren't copied at all, so a machine can be run up to a common point
+    // once and then forked for each variation at little cost.
+    // Assigning a fork back to the original restores that state.
+    // Forks share the original's stop token.
+    IntcodeMachine fork() const {
+        return *this;
+    }
+
+    // Queue values to be consumed by future INPUT instructions
+    void feed(intcode_type value);
+    void feed(std::initializer_list<intcode_type> values);
+
+    // Run until an INPUT instruction finds no queued input
+    // or the program halts. Outputs accumulate until taken.
+    State run_until_input_needed();
+    // Same as run_until_input_needed(), but also pause after each OUTPUT
+    State run_until_output();
+
+    bool has_output() const {
+        return !outputs.empty();
+    }
+    intcode_type take_output();
+    std::vector<intcode_type> take_outputs();
+
+    size_t pending_input() const {
+        return inputs.size();
+    }
+
+    // The machine checks the token at every INPUT and jump instruction.
+    // Once it's triggered, runs return STOPPED without making progress.
+    void set_stop_token(const StopToken &token) {
+        stop_token = token;
+    }
+
+    // Run native code instead of interpreting, for as long as the program
+    // doesn't modify its own instructions. Returns false, leaving the
+    // machine interpreted, if memory doesn't match the compiled program.
+    bool set_native_program(const NativeProgram *program);
+
+    void set_dispatch(Dispatch new_dispatch) {
+        dispatch = new_dispatch;
+    }
+
+    // Whether THREADED dispatch fuses common instruction pairs in hot
+    // blocks into superinstructions. Enabled by default.
+    void set_fusion(bool enabled) {
+        fusion_enabled = enabled;
+    }
+
+    // When no input is queued, have INPUT read value instead of pausing,
+    // as if polling an empty queue. Once polling is all the program does,
+    // the machine parks instead: if it gets back to the same INPUT without
+    // changing memory or producing output since the last poll, or it has
+    // polled MAX_IDLE_POLLS times in a row without producing output, it
+    // pauses with NEEDS_INPUT and stays paused until it's fed. So a program
+    // that writes memory between polls, a counter say, parks after the
+    // limit, and one that needs more polls than that before it outputs
+    // anything won't get them.
+    static constexpr size_t MAX_IDLE_POLLS = 1000;
+    void set_default_input(intcode_type value) {
+        has_default_input = true;
+        default_input = value;
+    }
+
+    // Count every instruction executed into profile, or stop counting if
+    // it's null. Profiled runs always use SWITCH dispatch and skip native
+    // code, so that every instruction passes through the same place.
+    // Forks share the profile.
+    void set_profile(IntcodeProfile *new_profile) {
+        profile = new_profile;
+    }
+
+    // Number of handler dispatches so far. Only counted when built with
+    // INTCODE_COUNT_DISPATCHES, and only by THREADED dispatch.
+    std::uint64_t dispatch_count() const {
+        return dispatches;
+    }
+
+    State get_state() const {
+        return state;
+    }
+
+    intcode_type read(intcode_type address) const {
+        return memory.read(address);
+    }
+    void write(intcode_type address, intcode_type value) {
+        if (has_default_input && !changed_since_poll && memory.read(address) != value) {
+            changed_since_poll = true;
+        }
+        memory[address] = value;
+        if (static_cast<size_t>(address) < code.instructions.size() || native_program) {
+            invalidate_code(address);
+        }
+    }
+
+private:
+    // Lanes that leave lockstep continue as ordinary machines
+    friend class IntcodeBatch;
+
+    State run(bool stop_on_output);
+    State run_engine(bool stop_on_output);
+    // Profile is either IntcodeProfile or a stand-in whose
+    // counting functions do nothing, for unprofiled runs
+    template <typename Profile>
+    State run_switch(bool stop_on_output, Profile &profile);
+    State run_threaded(bool stop_on_output);
+    IntcodeInstruction fetch(intcode_type address);
+    IntcodeInstruction decode(intcode_type address);
+    void grow_decode_cache(size_t size);
+    void invalidate_code(intcode_type address);
+    // Called with the address execution continues at after each jump,
+    // whether or not it was taken
+    void note_block_entry(intcode_type address) {
+        if (static_cast<size_t>(address) < code.block_heat.size()
+                && code.block_heat[address] < HOT_BLOCK_THRESHOLD
+                && ++code.block_heat[address] == HOT_BLOCK_THRESHOLD) {
+            fuse_block(address);
+        }
+    }
+    void fuse_block(intcode_type address);
+    void unfuse_around(intcode_type address);
+
+    // Number of times execution must enter a block
+    // at an address before the block is fused
+    static constexpr std::uint8_t HOT_BLOCK_THRESHOLD = 8;
+
+    // Everything the machine has worked out about the code in memory.
+    // It can always be rebuilt from memory, so a copy starts out empty
+    // instead of duplicating it, which keeps fork() cheap however much
+    // code the original has run.
+    struct DecodeCache {
+        DecodeCache() = default;
+        DecodeCache(const DecodeCache &) {}
+        DecodeCache(DecodeCache &&) = default;
+        DecodeCache &operator=(const DecodeCache &) {
+            instructions.clear();
+            block_heat.clear();
+            fused_cells.clear();
+            return *this;
+        }
+        DecodeCache &operator=(DecodeCache &&) = default;
+
+        // Decoded instructions, indexed by address
+        std::vector<IntcodeInstruction> instructions;
+        // Also indexed by address: how often blocks have been entered there,
+        // and whether the cell is part of a fused instruction pair
+        // (other than the first cell, which instructions already tracks)
+        std::vector<std::uint8_t> block_heat;
+        std::vector<bool> fused_cells;
+    };
+
+    program_type memory;
+    intcode_type pc = 0, relative_base = 0;
+    DecodeCache code;
+    // The decoded instruction table of the image the machine was loaded
+    // from, if any, and that image's memory, which tells a corrupt entry
+    // apart from one the program has since overwritten
+    std::shared_ptr<const std::uint16_t> image_handlers;
+    size_t image_cells = 0;
+    program_type image_program;
+    bool fusion_enabled = true;
+    std::uint64_t dispatches = 0;
+    std::deque<intcode_type> inputs, outputs;
+    State state = State::READY;
+    StopToken stop_token;
+    Dispatch dispatch = Dispatch::THREADED;
+    const NativeProgram *native_program = nullptr;
+    IntcodeProfile *profile = nullptr;
+    // See set_default_input(). The poll_ members record where the last
+    // poll happened and how many outputs were waiting at the time, and
+    // idle_polls counts polls since the last input or output.
+    bool has_default_input = false;
+    intcode_type default_input = 0;
+    bool changed_since_poll = true;
+    intcode_type poll_pc = -1, poll_relative_base = 0;
+    size_t poll_outputs = 0;
+    size_t idle_polls = 0;
+};
+
+
+// Whether Input and Output can serve as run_intcode_program() callbacks
+template <typename Input, typename Output>
+constexpr bool is_intcode_callbacks_v = std::is_invocable_r_v<intcode_type, Input &>
+                                        && std::is_invocable_v<Output &, intcode_type>;
+
+// I/O policy which forwards to a pair of callbacks. A policy is any type
+// with input() and output(intcode_type) members, see run_intcode_io().
+template <typename Input, typename Output>
+struct IntcodeCallbacks {
+    Input input_callback;
+    Output output_callback;
+
+    intcode_type input() {
+        return input_callback();
+    }
+    void output(intcode_type value) {
+        output_callback(value);
+    }
+};
+
+// Run a program to completion, asking io for each input and handing it
+// each output. Since the policy's type is known at compile time, its
+// functions can be inlined, unlike calls through std::function.
+// See run_intcode_program() for how stop_token behaves.
+template <typename IO>
+intcode_type run_intcode_io(const program_type &program, IO &io,
+                            const StopToken &stop_token = StopToken(),
+                            IntcodeProfile *profile = nullptr) {
+    IntcodeMachine machine(program);
+    machine.set_stop_token(stop_token);
+    machine.set_profile(profile);
+    while (true) {
+        switch (machine.run_until_output()) {
+            case IntcodeMachine::State::NEEDS_INPUT: {
+                auto value = io.input();
+                // The input callback may have requested a stop
+                // instead of providing a real value
+                if (!stop_token.stop_requested()) {
+                    machine.feed(value);
+                }
+                break;
+            }
+            case IntcodeMachine::State::HAS_OUTPUT:
+                io.output(machine.take_output());
+                break;
+            case IntcodeMachine::State::HALTED:
+            case IntcodeMachine::State::STOPPED:
+                return machine.read(0);
+            default:
+                throw std::logic_error("Intcode machine stopped unexpectedly");
+        }
+    }
+}
+
+// Accepts any callables, such as lambdas, which are called directly
+template <typename Input, typename Output,
+          typename = std::enable_if_t<is_intcode_callbacks_v<Input, Output> > >
+intcode_type run_intcode_program(const program_type &program, Input input, Output output,
+                                 const StopToken &stop_token = StopToken()) {
+    IntcodeCallbacks<Input, Output> io{std::move(input), std::move(output)};
+    return run_intcode_io(program, io, stop_token);
+}
+
+// Same, but counts every instruction executed into profile
+template <typename Input, typename Output,
+          typename = std::enable_if_t<is_intcode_callbacks_v<Input, Output> > >
+intcode_type run_intcode_program(const program_type &program, Input input, Output output,
+                                 IntcodeProfile &profile) {
+    IntcodeCallbacks<Input, Output> io{std::move(input), std::move(output)};
+    return run_intcode_io(program, io, StopToken(), &profile);
+}
+
+
+// Run a fork of start for each set of inputs, spread across a pool of
+// threads, until it halts or runs out of input. Returns each run's
+// outputs, in the same order as inputs.
+std::vector<std::vector<intcode_type> > run_intcode_batch(
+    const IntcodeMachine &start,
+    const std::vector<std::vector<intcode_type> > &inputs);
+
+
+// Forks of one machine which run in lockstep, for as long as their control
+// flow agrees. Each lane has its own inputs and memory, but they share a
+// program counter and relative base, so an instruction is decoded once and
+// then applied to every lane. Memory is stored as structure-of-arrays: cells
+// which hold the same value in every lane are stored once, and the rest have
+// one value per lane, side by side.
+//
+// A lane whose control flow diverges from the majority of the others drops
+// out of lockstep and carries on as a scalar IntcodeMachine. The same goes
+// for lanes which run out of input.
+class IntcodeBatch {
+public:
+    IntcodeBatch(const IntcodeMachine &start, size_t num_lanes);
+
+    size_t size() const {
+        return num_lanes;
+    }
+
+    void feed(size_t lane, intcode_type value);
+    void write(size_t lane, intcode_type address, intcode_type value);
+
+    // Run every lane until it halts or needs input
+    void run();
+
+    intcode_type read(size_t lane, intcode_type address) const;
+    std::vector<intcode_type> take_outputs(size_t lane);
+
+    // How many lanes have left lockstep
+    size_t num_scalar_lanes() const;
+
+private:
+    // Values of an operand across the lanes in lockstep:
+    // either the same for all of them, or one per lane in row
+    struct LaneValues {
+        bool uniform;
+        intcode_type value;
+        const intcode_type *row;
+
+        intcode_type at(size_t column) const {
+            return uniform ? value : row[column];
+        }
+    };
+
+    // A block of cells with one value per lane. Cell i of lane column c
+    // is at cells[i * width + c]. Cells which have the same value in
+    // every lane are flagged as uniform.
+    struct LanePage {
+        std::vector<intcode_type> cells;
+        std::vector<bool> uniform;
+    };
+
+    static constexpr size_t LANE_PAGE_BITS = 6;
+    static constexpr size_t LANE_PAGE_SIZE = size_t{1} << LANE_PAGE_BITS;
+    static constexpr size_t LANE_PAGE_MASK = LANE_PAGE_SIZE - 1;
+    // Lanes can only hold different values below this address
+    static constexpr intcode_type MAX_LANE_ADDRESS = static_cast<intcode_type>(
+        IntcodeMemory::MAX_PAGES * IntcodeMemory::PAGE_SIZE);
+
+    void run_lockstep();
+    bool step();
+
+    size_t width() const {
+        return columns.size();
+    }
+    LanePage *find_lane_page(intcode_type address);
+    const LanePage *find_lane_page(intcode_type address) const;
+    LanePage &lane_page(intcode_type address);
+    // Whether every lane in lockstep has the same value in row
+    bool all_equal(const intcode_type *row) const;
+    // values, flagged as uniform if they're all the same
+    LaneValues collapse(const LaneValues &values) const;
+    intcode_type read_column(intcode_type address, size_t column) const;
+    LaneValues load(intcode_type address) const;
+    LaneValues load_operand(int index, Mode mode, std::vector<intcode_type> &scratch) const;
+    LaneValues load_address(int index, Mode mode, std::vector<intcode_type> &scratch) const;
+    bool store(const LaneValues &addresses, const LaneValues &values);
+    template <typename Op>
+    LaneValues combine(const LaneValues &a, const LaneValues &b, Op op);
+
+    // Move the lanes in lockstep for which keep is false into scalar
+    // machines, paused at the current instruction
+    void drop_lanes(const std::vector<bool> &keep);
+    // Keep only the lanes whose key matches the most common one.
+    // The keys must differ, or no lane would be dropped.
+    void keep_majority(const LaneValues &keys);
+
+    size_t num_lanes;
+    // Registers shared by the lanes in lockstep
+    intcode_type pc, relative_base;
+    bool halted = false;
+    // Cells which are the same in every lane and have no lane page
+    IntcodeMemory memory;
+    // Indexed by address >> LANE_PAGE_BITS. Empty if not allocated.
+    std::vector<LanePage> lane_pages;
+    // The lane each column of a lane page belongs to
+    std::vector<size_t> columns;
+    // The column of each lane still in lockstep
+    std::vector<size_t> lane_columns;
+    std::vector<std::deque<intcode_type> > inputs;
+    std::vector<std::vector<intcode_type> > outputs;
+    // Lanes which have left lockstep
+    std::vector<std::unique_ptr<IntcodeMachine> > scalar_lanes;
+    std::vector<intcode_type> scratch_a, scratch_b, scratch_address, scratch_result;
+};
+
+
+// Like run_intcode_batch(), but runs groups of forks in lockstep
+// with an IntcodeBatch. The groups are spread across a pool of threads.
+std::vector<std::vector<intcode_type> > run_intcode_lockstep(
+    const IntcodeMachine &start,
+    const std::vector<std::vector<intcode_type> > &inputs);
+
+
+// Line-based text I/O with a program that speaks ASCII. Lines of input are
+// queued whole, and output is collected into a reusable buffer until the
+// program stops to wait for input, which marks the end of a prompt.
+// Callers can then print each prompt with a single write.
+class AsciiChannel {
+public:
+    explicit AsciiChannel(IntcodeMachine machine);
+
+    // Run until the program needs input or halts. Returns the text printed
+    // since the last call, which stays valid until the next one. Values
+    // outside the ASCII range are set aside, see take_values().
+    const std::string &read_until_prompt();
+
+    // Queue a line of input, adding the newline
+    void send_line(const std::string &line);
+
+    // Output values which aren't characters, such as a final answer
+    std::vector<intcode_type> take_values();
+
+    IntcodeMachine::State get_state() const {
+        return machine.get_state();
+    }
+
+    bool halted() const {
+        return machine.get_state() == IntcodeMachine::State::HALTED;
+    }
+
+private:
+    IntcodeMachine machine;
+    std::string text;
+    std::vector<intcode_type> values;
+};
+
+
+// Runs many machines on a fixed pool of worker threads. Each worker has
+// its own deque of runnable machines, taking the newest from the back,
+// and steals the oldest from the front of another worker's deque when
+// its own runs dry. A machine runs until it needs input, then yields its
+// worker. It becomes runnable again when values are sent to its inbox.
+//
+// Machines that poll for input should be given a default input, see
+// IntcodeMachine::set_default_input(), so that they park rather than
+// holding a worker forever. A parked machine only runs again when it's
+// sent values, so one that has to poll more than
+// IntcodeMachine::MAX_IDLE_POLLS times before it outputs won't progress.
+class IntcodeExecutor {
+public:
+    // Called on a worker thread with a machine's id and whatever it output
+    // during its last run, whenever that isn't empty. Calls for any one
+    // machine never overlap, but calls for different machines may.
+    using OutputHandler = std::function<void(size_t, const std::vector<intcode_type> &)>;
+
+    explicit IntcodeExecutor(size_t num_workers = std::thread::hardware_concurrency());
+
+    // Add a machine, which runs as soon as run() is called.
+    // Returns its id, which is the number of machines added before it.
+    size_t add_machine(IntcodeMachine machine);
+
+    // Queue values for a machine and make it runnable if it isn't already.
+    // Safe to call from output handlers and between runs.
+    void send(size_t id, std::initializer_list<intcode_type> values);
+
+    // Run machines until none are runnable, that is until every machine
+    // has halted or is waiting on an empty inbox. Rethrows the first
+    // exception from any machine or handler, after which the executor
+    // shouldn't be used again.
+    //
+    // Every machine is given stop_token, see IntcodeMachine::set_stop_token().
+    // Once it's triggered, running machines return STOPPED, workers take no
+    // more machines and run() returns early. The same goes for a stopped
+    // executor as for one that threw.
+    void run(const OutputHandler &handler, const StopToken &stop_token = StopToken());
+
+    size_t size() const {
+        return slots.size();
+    }
+
+    // Only safe to use while the executor isn't running
+    IntcodeMachine &machine(size_t id) {
+        return slots.at(id)->machine;
+    }
+
+    // Totals across all calls to run()
+    std::uint64_t slices_run() const {
+        return slices;
+    }
+    std::uint64_t steals_made() const {
+        return steals;
+    }
+
+private:
+    struct Slot {
+        explicit Slot(IntcodeMachine machine): machine(std::move(machine)) {}
+
+        IntcodeMachine machine;
+        std::mutex mutex;
+        // Both guarded by mutex. A scheduled machine is either waiting
+        // in a deque or running, so it mustn't be queued again.
+        std::deque<intcode_type> inbox;
+        bool scheduled = true;
+    };
+
+    // Keep each deque on its own cache line to avoid false sharing
+    struct alignas(64) WorkerDeque {
+        std::mutex mutex;
+        std::deque<size_t> ids;
+    };
+
+    void work(size_t worker, const OutputHandler &handler, const StopToken &stop_token);
+    void run_slice(size_t worker, size_t id, const OutputHandler &handler);
+    void push(size_t worker, size_t id);
+    bool pop(size_t worker, size_t &id);
+    bool steal(size_t worker, size_t &id);
+    // Sleep until a machine is queued or the run finishes. Returns false
+    // if the run has finished.
+    bool wait_for_work();
+    void finish();
+
+    std::vector<std::unique_ptr<Slot> > slots;
+    std::vector<WorkerDeque> deques;
+    // Machines which are scheduled, and how many of those are in a deque
+    std::atomic<size_t> pending{0}, queued{0};
+    std::atomic<bool> done{false};
+    std::mutex idle_mutex;
+    std::condition_variable work_added;
+    std::atomic<size_t> sleeping{0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    std::atomic<std::uint64_t> slices{0}, steals{0};
+};
+
+
+// Memoizes runs of a deterministic program: the outputs it produces for
+// a list of inputs, running from the start until it halts or needs more
+// input. Results are keyed by a hash of the program as well as the
+// inputs, so one file can hold results for several programs.
+//
+// The program is run up to its first input once, and each probe forks
+// from there. Not safe to use from several threads at once.
+class IntcodeProbeCache {
+public:
+    // If filename isn't empty, results for this program are loaded from
+    // it, if it exists, and new results are appended to it
+    explicit IntcodeProbeCache(const program_type &program, const std::string &filename = "");
+
+    const std::vector<intcode_type> &probe(const std::vector<intcode_type> &inputs);
+    // Results for many probes, in the same order as inputs. Those that
+    // aren't cached are run together, see run_intcode_lockstep().
+    std::vector<std::vector<intcode_type> > probe_all(
+        const std::vector<std::vector<intcode_type> > &inputs);
+
+    std::uint64_t program_hash() const {
+        return hash;
+    }
+    size_t hits() const {
+        return num_hits;
+    }
+    size_t misses() const {
+        return num_misses;
+    }
+
+private:
+    struct InputsHash {
+        size_t operator()(const std::vector<intcode_type> &inputs) const;
+    };
+
+    const std::vector<intcode_type> &store(const std::vector<intcode_type> &inputs,
+                                           std::vector<intcode_type> outputs);
+    bool load(const std::string &filename);
+
+    IntcodeMachine start;
+    std::uint64_t hash;
+    std::unordered_map<std::vector<intcode_type>, std::vector<intcode_type>, InputsHash> results;
+    // Open for appending if results are being saved
+    std::unique_ptr<std::ofstream> file;
+    size_t num_hits = 0, num_misses = 0;
+};
@@ -0,0 +1,41 @@
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "intcode.h"
+
+
+// Largest output value that's treated as a character
+constexpr intcode_type MAX_ASCII = 127;
+
+
+AsciiChannel::AsciiChannel(IntcodeMachine machine): machine(std::move(machine)) {}
+
+
+const std::string &AsciiChannel::read_until_prompt() {
+    text.clear();
+    machine.run_until_input_needed();
+    for (auto value: machine.take_outputs()) {
+        if (value >= 0 && value <= MAX_ASCII) {
+            text += static_cast<char>(value);
+        } else {
+            values.push_back(value);
+        }
+    }
+    return text;
+}
+
+
+void AsciiChannel::send_line(const std::string &line) {
+    for (auto c: line) {
+        machine.feed(static_cast<intcode_type>(c));
+    }
+    machine.feed(static_cast<intcode_type>('\n'));
+}
+
+
+std::vector<intcode_type> AsciiChannel::take_values() {
+    std::vector<intcode_type> taken;
+    std::swap(taken, values);
+    return taken;
+}
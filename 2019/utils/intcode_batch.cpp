@@ -0,0 +1,528 @@
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#include "intcode.h"
+#include "utils.h"
+
+
+// Number of lanes run_intcode_lockstep() puts in each IntcodeBatch
+constexpr size_t LOCKSTEP_WIDTH = 64;
+
+
+IntcodeBatch::IntcodeBatch(const IntcodeMachine &start, size_t num_lanes):
+        num_lanes(num_lanes),
+        pc(start.pc),
+        relative_base(start.relative_base),
+        halted(start.state == IntcodeMachine::State::HALTED),
+        memory(start.memory),
+        columns(num_lanes),
+        lane_columns(num_lanes),
+        inputs(num_lanes, start.inputs),
+        outputs(num_lanes, std::vector<intcode_type>(start.outputs.begin(),
+                                                     start.outputs.end())),
+        scalar_lanes(num_lanes) {
+    for (size_t lane = 0; lane < num_lanes; ++lane) {
+        columns[lane] = lane;
+        lane_columns[lane] = lane;
+    }
+}
+
+
+void IntcodeBatch::feed(size_t lane, intcode_type value) {
+    if (scalar_lanes[lane]) {
+        scalar_lanes[lane]->feed(value);
+    } else {
+        inputs[lane].push_back(value);
+    }
+}
+
+
+void IntcodeBatch::write(size_t lane, intcode_type address, intcode_type value) {
+    if (scalar_lanes[lane]) {
+        scalar_lanes[lane]->write(address, value);
+        return;
+    }
+    if (address < 0 || address >= MAX_LANE_ADDRESS) {
+        std::stringstream error_message;
+        error_message << "Index out of range for a single lane: " << address;
+        throw std::out_of_range(error_message.str());
+    }
+    auto &page = lane_page(address);
+    auto offset = static_cast<size_t>(address) & LANE_PAGE_MASK;
+    auto row = page.cells.data() + offset * width();
+    row[lane_columns[lane]] = value;
+    page.uniform[offset] = all_equal(row);
+}
+
+
+void IntcodeBatch::run() {
+    if (!halted && width() > 0) {
+        run_lockstep();
+    }
+    for (auto &machine: scalar_lanes) {
+        if (machine) {
+            machine->run_until_input_needed();
+        }
+    }
+}
+
+
+intcode_type IntcodeBatch::read(size_t lane, intcode_type address) const {
+    if (scalar_lanes[lane]) {
+        return scalar_lanes[lane]->read(address);
+    }
+    return read_column(address, lane_columns[lane]);
+}
+
+
+std::vector<intcode_type> IntcodeBatch::take_outputs(size_t lane) {
+    auto values = std::move(outputs[lane]);
+    outputs[lane].clear();
+    if (scalar_lanes[lane]) {
+        auto scalar_values = scalar_lanes[lane]->take_outputs();
+        values.insert(values.end(), scalar_values.begin(), scalar_values.end());
+    }
+    return values;
+}
+
+
+size_t IntcodeBatch::num_scalar_lanes() const {
+    return num_lanes - width();
+}
+
+
+void IntcodeBatch::run_lockstep() {
+    while (width() > 0 && step()) {}
+}
+
+
+template <typename Op>
+IntcodeBatch::LaneValues IntcodeBatch::combine(const LaneValues &a, const LaneValues &b, Op op) {
+    if (a.uniform && b.uniform) {
+        return LaneValues{true, op(a.value, b.value), nullptr};
+    }
+    // Separate loops for each case keep them simple enough to vectorize
+    auto count = width();
+    scratch_result.resize(count);
+    auto result = scratch_result.data();
+    if (a.uniform) {
+        for (size_t i = 0; i < count; ++i) {
+            result[i] = op(a.value, b.row[i]);
+        }
+    } else if (b.uniform) {
+        for (size_t i = 0; i < count; ++i) {
+            result[i] = op(a.row[i], b.value);
+        }
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            result[i] = op(a.row[i], b.row[i]);
+        }
+    }
+    return LaneValues{false, 0, result};
+}
+
+
+// Execute the instruction at pc across all lanes in lockstep,
+// unless some of them need to drop out first.
+// Returns false once lockstep execution is over.
+bool IntcodeBatch::step() {
+    auto word = collapse(load(pc));
+    if (!word.uniform) {
+        // The lanes have modified this instruction differently
+        keep_majority(word);
+        return true;
+    }
+    auto instruction = decode_instruction(word.value);
+    auto opcode = instruction.opcode;
+    const auto &modes = instruction.modes;
+    switch (opcode) {
+        case Opcode::ADD:
+        case Opcode::MULTIPLY:
+        case Opcode::LESS_THAN:
+        case Opcode::EQUALS: {
+            auto a = load_operand(1, modes[0], scratch_a);
+            auto b = load_operand(2, modes[1], scratch_b);
+            auto address = load_address(3, modes[2], scratch_address);
+            LaneValues result;
+            switch (opcode) {
+                case Opcode::ADD:
+                    result = combine(a, b, [](intcode_type x, intcode_type y) {
+                        return x + y;
+                    });
+                    break;
+                case Opcode::MULTIPLY:
+                    result = combine(a, b, [](intcode_type x, intcode_type y) {
+                        return x * y;
+                    });
+                    break;
+                case Opcode::LESS_THAN:
+                    result = combine(a, b, [](intcode_type x, intcode_type y) {
+                        return static_cast<intcode_type>(x < y);
+                    });
+                    break;
+                default:
+                    result = combine(a, b, [](intcode_type x, intcode_type y) {
+                        return static_cast<intcode_type>(x == y);
+                    });
+                    break;
+            }
+            if (!store(address, result)) {
+                drop_lanes(std::vector<bool>(width(), false));
+                return false;
+            }
+            pc += 4;
+            return true;
+        }
+        case Opcode::INPUT: {
+            std::vector<bool> keep(width());
+            auto all_have_input = true;
+            for (size_t column = 0; column < width(); ++column) {
+                keep[column] = !inputs[columns[column]].empty();
+                all_have_input = all_have_input && keep[column];
+            }
+            if (!all_have_input) {
+                drop_lanes(keep);
+                return true;
+            }
+            auto address = load_address(1, modes[0], scratch_address);
+            scratch_result.resize(width());
+            for (size_t column = 0; column < width(); ++column) {
+                scratch_result[column] = inputs[columns[column]].front();
+            }
+            if (!store(address, LaneValues{false, 0, scratch_result.data()})) {
+                drop_lanes(std::vector<bool>(width(), false));
+                return false;
+            }
+            for (auto lane: columns) {
+                inputs[lane].pop_front();
+            }
+            pc += 2;
+            return true;
+        }
+        case Opcode::OUTPUT: {
+            auto value = load_operand(1, modes[0], scratch_a);
+            for (size_t column = 0; column < width(); ++column) {
+                outputs[columns[column]].push_back(value.at(column));
+            }
+            pc += 2;
+            return true;
+        }
+        case Opcode::REL_BASE: {
+            auto value = collapse(load_operand(1, modes[0], scratch_a));
+            if (!value.uniform) {
+                keep_majority(value);
+                return true;
+            }
+            relative_base += value.value;
+            pc += 2;
+            return true;
+        }
+        case Opcode::JUMP_TRUE:
+        case Opcode::JUMP_FALSE: {
+            auto condition = load_operand(1, modes[0], scratch_a);
+            auto destination = load_operand(2, modes[1], scratch_b);
+            auto jump_when = opcode == Opcode::JUMP_TRUE;
+            if (condition.uniform && destination.uniform) {
+                pc = (condition.value != 0) == jump_when ? destination.value : pc + 3;
+                return true;
+            }
+            scratch_result.resize(width());
+            auto all_agree = true;
+            for (size_t column = 0; column < width(); ++column) {
+                scratch_result[column] = (condition.at(column) != 0) == jump_when
+                                         ? destination.at(column) : pc + 3;
+                all_agree = all_agree && scratch_result[column] == scratch_result[0];
+            }
+            if (all_agree) {
+                pc = scratch_result[0];
+            } else {
+                keep_majority(LaneValues{false, 0, scratch_result.data()});
+            }
+            return true;
+        }
+        case Opcode::END:
+            halted = true;
+            return false;
+        default:
+            std::stringstream error_message;
+            error_message << "Unexpected opcode: " << static_cast<int>(opcode);
+            throw std::logic_error(error_message.str());
+    }
+}
+
+
+IntcodeBatch::LanePage *IntcodeBatch::find_lane_page(intcode_type address) {
+    if (address < 0 || address >= MAX_LANE_ADDRESS) {
+        return nullptr;
+    }
+    auto page_num = static_cast<size_t>(address) >> LANE_PAGE_BITS;
+    if (page_num < lane_pages.size() && !lane_pages[page_num].cells.empty()) {
+        return &lane_pages[page_num];
+    }
+    return nullptr;
+}
+
+
+const IntcodeBatch::LanePage *IntcodeBatch::find_lane_page(intcode_type address) const {
+    return const_cast<IntcodeBatch *>(this)->find_lane_page(address);
+}
+
+
+// Return the lane page containing address, which must be within
+// [0, MAX_LANE_ADDRESS), copying its cells into every lane if needed
+IntcodeBatch::LanePage &IntcodeBatch::lane_page(intcode_type address) {
+    auto page_num = static_cast<size_t>(address) >> LANE_PAGE_BITS;
+    if (page_num >= lane_pages.size()) {
+        lane_pages.resize(page_num + 1);
+    }
+    auto &page = lane_pages[page_num];
+    if (page.cells.empty()) {
+        auto start = static_cast<intcode_type>(page_num << LANE_PAGE_BITS);
+        page.cells.resize(LANE_PAGE_SIZE * width());
+        page.uniform.assign(LANE_PAGE_SIZE, true);
+        for (size_t offset = 0; offset < LANE_PAGE_SIZE; ++offset) {
+            auto value = memory.read(start + static_cast<intcode_type>(offset));
+            std::fill_n(page.cells.begin() + offset * width(), width(), value);
+        }
+    }
+    return page;
+}
+
+
+intcode_type IntcodeBatch::read_column(intcode_type address, size_t column) const {
+    auto page = find_lane_page(address);
+    if (page) {
+        auto offset = static_cast<size_t>(address) & LANE_PAGE_MASK;
+        return page->cells[offset * width() + column];
+    }
+    return memory.read(address);
+}
+
+
+bool IntcodeBatch::all_equal(const intcode_type *row) const {
+    return std::all_of(row, row + width(), [row](intcode_type value) -> bool {
+        return value == row[0];
+    });
+}
+
+
+IntcodeBatch::LaneValues IntcodeBatch::collapse(const LaneValues &values) const {
+    if (values.uniform || !all_equal(values.row)) {
+        return values;
+    }
+    return LaneValues{true, values.row[0], nullptr};
+}
+
+
+IntcodeBatch::LaneValues IntcodeBatch::load(intcode_type address) const {
+    auto page = find_lane_page(address);
+    if (page) {
+        auto offset = static_cast<size_t>(address) & LANE_PAGE_MASK;
+        auto row = page->cells.data() + offset * width();
+        if (page->uniform[offset]) {
+            return LaneValues{true, row[0], nullptr};
+        }
+        return LaneValues{false, 0, row};
+    }
+    return LaneValues{true, memory.read(address), nullptr};
+}
+
+
+// Address that the operand at pc + index refers to in each lane
+IntcodeBatch::LaneValues IntcodeBatch::load_address(
+        int index, Mode mode, std::vector<intcode_type> &scratch) const {
+    auto parameter = load(pc + index);
+    switch (mode) {
+        case Mode::POSITIONAL:
+            return parameter;
+        case Mode::RELATIVE:
+            if (parameter.uniform) {
+                return LaneValues{true, relative_base + parameter.value, nullptr};
+            }
+            scratch.resize(width());
+            for (size_t column = 0; column < width(); ++column) {
+                scratch[column] = relative_base + parameter.row[column];
+            }
+            return LaneValues{false, 0, scratch.data()};
+        default:
+            std::stringstream error_message;
+            error_message << "Operand " << index << " of instruction at " << pc;
+            error_message << " expects positional or relative mode";
+            throw std::logic_error(error_message.str());
+    }
+}
+
+
+// Value of the operand at pc + index in each lane
+IntcodeBatch::LaneValues IntcodeBatch::load_operand(
+        int index, Mode mode, std::vector<intcode_type> &scratch) const {
+    if (mode == Mode::IMMEDIATE) {
+        return load(pc + index);
+    }
+    auto address = load_address(index, mode, scratch);
+    if (address.uniform) {
+        return load(address.value);
+    }
+    // Each lane reads from a different address
+    scratch.resize(width());
+    for (size_t column = 0; column < width(); ++column) {
+        scratch[column] = read_column(address.row[column], column);
+    }
+    return LaneValues{false, 0, scratch.data()};
+}
+
+
+// Write values to addresses in each lane. Returns false without writing
+// anything if lanes would need to differ at an address which can't hold
+// a value per lane.
+bool IntcodeBatch::store(const LaneValues &addresses, const LaneValues &values) {
+    if (addresses.uniform) {
+        auto address = addresses.value;
+        auto page = find_lane_page(address);
+        if (values.uniform && !page) {
+            memory[address] = values.value;
+            return true;
+        }
+        if (address < 0 || address >= MAX_LANE_ADDRESS) {
+            return false;
+        }
+        auto &target = lane_page(address);
+        auto offset = static_cast<size_t>(address) & LANE_PAGE_MASK;
+        auto row = target.cells.data() + offset * width();
+        for (size_t column = 0; column < width(); ++column) {
+            row[column] = values.at(column);
+        }
+        target.uniform[offset] = values.uniform || all_equal(row);
+        return true;
+    }
+
+    for (size_t column = 0; column < width(); ++column) {
+        auto address = addresses.row[column];
+        if (address < 0 || address >= MAX_LANE_ADDRESS) {
+            return false;
+        }
+    }
+    for (size_t column = 0; column < width(); ++column) {
+        auto address = addresses.row[column];
+        auto &target = lane_page(address);
+        auto offset = static_cast<size_t>(address) & LANE_PAGE_MASK;
+        target.cells[offset * width() + column] = values.at(column);
+    }
+    // Only once every lane has written can a cell be known to be uniform
+    for (size_t column = 0; column < width(); ++column) {
+        auto address = addresses.row[column];
+        auto &target = lane_page(address);
+        auto offset = static_cast<size_t>(address) & LANE_PAGE_MASK;
+        target.uniform[offset] = all_equal(target.cells.data() + offset * width());
+    }
+    return true;
+}
+
+
+void IntcodeBatch::drop_lanes(const std::vector<bool> &keep) {
+    std::vector<size_t> kept;
+    for (size_t column = 0; column < width(); ++column) {
+        if (keep[column]) {
+            kept.push_back(column);
+            continue;
+        }
+        // Shared memory plus whatever differs in this lane
+        auto lane = columns[column];
+        auto machine = std::make_unique<IntcodeMachine>(memory);
+        for (size_t page_num = 0; page_num < lane_pages.size(); ++page_num) {
+            const auto &page = lane_pages[page_num];
+            if (page.cells.empty()) {
+                continue;
+            }
+            auto start = static_cast<intcode_type>(page_num << LANE_PAGE_BITS);
+            for (size_t offset = 0; offset < LANE_PAGE_SIZE; ++offset) {
+                auto address = start + static_cast<intcode_type>(offset);
+                auto value = page.cells[offset * width() + column];
+                if (machine->read(address) != value) {
+                    machine->write(address, value);
+                }
+            }
+        }
+        machine->pc = pc;
+        machine->relative_base = relative_base;
+        machine->inputs = std::move(inputs[lane]);
+        scalar_lanes[lane] = std::move(machine);
+    }
+
+    // Squeeze the remaining lanes together
+    auto old_width = width();
+    for (auto &page: lane_pages) {
+        if (page.cells.empty()) {
+            continue;
+        }
+        std::vector<intcode_type> cells(LANE_PAGE_SIZE * kept.size());
+        for (size_t offset = 0; offset < LANE_PAGE_SIZE; ++offset) {
+            auto row = cells.data() + offset * kept.size();
+            for (size_t column = 0; column < kept.size(); ++column) {
+                row[column] = page.cells[offset * old_width + kept[column]];
+            }
+            // The lanes that differed may all have been dropped
+            page.uniform[offset] = page.uniform[offset]
+                                   || std::all_of(row, row + kept.size(),
+                                                  [row](intcode_type value) -> bool {
+                                                      return value == row[0];
+                                                  });
+        }
+        page.cells = std::move(cells);
+    }
+    std::vector<size_t> new_columns;
+    for (auto column: kept) {
+        new_columns.push_back(columns[column]);
+        lane_columns[columns[column]] = new_columns.size() - 1;
+    }
+    columns = std::move(new_columns);
+    if (columns.empty()) {
+        lane_pages.clear();
+    }
+}
+
+
+void IntcodeBatch::keep_majority(const LaneValues &keys) {
+    if (collapse(keys).uniform) {
+        throw std::logic_error("Lanes in lockstep agree, so none can be dropped");
+    }
+    std::unordered_map<intcode_type, size_t> counts;
+    intcode_type most_common = keys.row[0];
+    for (size_t column = 0; column < width(); ++column) {
+        auto count = ++counts[keys.row[column]];
+        if (count > counts[most_common]) {
+            most_common = keys.row[column];
+        }
+    }
+    std::vector<bool> keep(width());
+    for (size_t column = 0; column < width(); ++column) {
+        keep[column] = keys.row[column] == most_common;
+    }
+    drop_lanes(keep);
+}
+
+
+std::vector<std::vector<intcode_type> > run_intcode_lockstep(
+        const IntcodeMachine &start,
+        const std::vector<std::vector<intcode_type> > &inputs) {
+    std::vector<std::vector<intcode_type> > outputs(inputs.size());
+    auto num_groups = (inputs.size() + LOCKSTEP_WIDTH - 1) / LOCKSTEP_WIDTH;
+    parallel_for(num_groups, [&](size_t group) -> void {
+        auto first = group * LOCKSTEP_WIDTH;
+        auto count = std::min(LOCKSTEP_WIDTH, inputs.size() - first);
+        IntcodeBatch batch(start, count);
+        for (size_t lane = 0; lane < count; ++lane) {
+            for (auto value: inputs[first + lane]) {
+                batch.feed(lane, value);
+            }
+        }
+        batch.run();
+        for (size_t lane = 0; lane < count; ++lane) {
+            outputs[first + lane] = batch.take_outputs(lane);
+        }
+    });
+    return outputs;
+}
@@ -0,0 +1,187 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+#include "intcode.h"
+
+
+constexpr std::uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+constexpr std::uint64_t FNV_PRIME = 1099511628211ull;
+
+
+std::uint64_t fnv1a(std::uint64_t hash, intcode_type value) {
+    auto bits = static_cast<std::uint64_t>(value);
+    for (auto i = 0; i < 8; ++i) {
+        hash ^= (bits >> (8 * i)) & 0xff;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+
+// Hash of the cells up to the last nonzero one, so that trailing zeros
+// in the last page don't matter
+std::uint64_t hash_program(const program_type &program) {
+    auto size = program.size();
+    while (size > 0 && program.read(size - 1) == 0) {
+        --size;
+    }
+    auto hash = fnv1a(FNV_OFFSET_BASIS, static_cast<intcode_type>(size));
+    for (size_t address = 0; address < size; ++address) {
+        hash = fnv1a(hash, program.read(address));
+    }
+    return hash;
+}
+
+
+size_t IntcodeProbeCache::InputsHash::operator()(
+        const std::vector<intcode_type> &inputs) const {
+    auto hash = FNV_OFFSET_BASIS;
+    for (auto value: inputs) {
+        hash = fnv1a(hash, value);
+    }
+    return static_cast<size_t>(hash);
+}
+
+
+IntcodeProbeCache::IntcodeProbeCache(const program_type &program,
+                                     const std::string &filename):
+        start(program), hash(hash_program(program)) {
+    start.run_until_input_needed();
+    if (filename.empty()) {
+        return;
+    }
+    auto ends_mid_line = load(filename);
+    file = std::make_unique<std::ofstream>(filename, std::ios::app);
+    if (!*file) {
+        std::stringstream error_message;
+        error_message << "Couldn't open probe cache for writing: " << filename;
+        throw std::runtime_error(error_message.str());
+    }
+    if (ends_mid_line) {
+        // Keep new results off the end of a torn line
+        *file << "\n";
+    }
+}
+
+
+// Each line of the file holds one result: the program's hash in hex,
+// then the number of inputs followed by the inputs, and likewise
+// for the outputs. Malformed lines, such as one torn by a run that was
+// killed mid-write, are skipped with a warning. Returns whether the
+// file ends partway through a line.
+bool IntcodeProbeCache::load(const std::string &filename) {
+    std::ifstream input_stream(filename);
+    std::string line;
+    size_t line_num = 0;
+    auto ends_mid_line = false;
+    while (std::getline(input_stream, line)) {
+        ++line_num;
+        // getline only reaches the end of the file if there's no newline
+        ends_mid_line = input_stream.eof();
+        std::istringstream line_stream(line);
+        std::uint64_t line_hash = 0;
+        size_t count = 0;
+        std::vector<intcode_type> inputs, outputs;
+        line_stream >> std::hex >> line_hash >> std::dec;
+        if (line_stream && line_hash != hash) {
+            // Belongs to another program
+            continue;
+        }
+        for (auto values: {&inputs, &outputs}) {
+            line_stream >> count;
+            // Read value by value, so a bad count can't allocate much
+            intcode_type value;
+            for (size_t i = 0; i < count && line_stream >> value; ++i) {
+                values->push_back(value);
+            }
+        }
+        if (!line_stream || !(line_stream >> std::ws).eof()) {
+            std::cerr << "Skipping malformed probe cache entry on line " << line_num;
+            std::cerr << " of " << filename << std::endl;
+            continue;
+        }
+        results[std::move(inputs)] = std::move(outputs);
+    }
+    return ends_mid_line;
+}
+
+
+const std::vector<intcode_type> &IntcodeProbeCache::store(
+        const std::vector<intcode_type> &inputs, std::vector<intcode_type> outputs) {
+    ++num_misses;
+    auto inserted = results.emplace(inputs, std::move(outputs));
+    if (!inserted.second) {
+        // Already cached, and so already in the file
+        return inserted.first->second;
+    }
+    const auto &stored = inserted.first->second;
+    if (file) {
+        *file << std::hex << hash << std::dec << " " << inputs.size();
+        for (auto value: inputs) {
+            *file << " " << value;
+        }
+        *file << " " << stored.size();
+        for (auto value: stored) {
+            *file << " " << value;
+        }
+        *file << "\n";
+    }
+    return stored;
+}
+
+
+const std::vector<intcode_type> &IntcodeProbeCache::probe(
+        const std::vector<intcode_type> &inputs) {
+    auto iter = results.find(inputs);
+    if (iter != results.end()) {
+        ++num_hits;
+        return iter->second;
+    }
+    auto machine = start.fork();
+    for (auto value: inputs) {
+        machine.feed(value);
+    }
+    machine.run_until_input_needed();
+    return store(inputs, machine.take_outputs());
+}
+
+
+std::vector<std::vector<intcode_type> > IntcodeProbeCache::probe_all(
+        const std::vector<std::vector<intcode_type> > &inputs) {
+    std::vector<std::vector<intcode_type> > outputs(inputs.size());
+    // Each distinct uncached input is run once, however often it appears,
+    // and which of those runs each input waits on
+    std::vector<std::vector<intcode_type> > missing_inputs;
+    std::unordered_map<std::vector<intcode_type>, size_t, InputsHash> missing_lanes;
+    std::vector<std::pair<size_t, size_t> > waiting;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        auto iter = results.find(inputs[i]);
+        if (iter != results.end()) {
+            ++num_hits;
+            outputs[i] = iter->second;
+            continue;
+        }
+        auto lane = missing_lanes.emplace(inputs[i], missing_inputs.size());
+        if (lane.second) {
+            missing_inputs.push_back(inputs[i]);
+        } else {
+            // Counted as a hit, as it would be if probed in turn
+            ++num_hits;
+        }
+        waiting.emplace_back(i, lane.first->second);
+    }
+    if (missing_inputs.empty()) {
+        return outputs;
+    }
+    auto missing_outputs = run_intcode_lockstep(start, missing_inputs);
+    for (size_t lane = 0; lane < missing_inputs.size(); ++lane) {
+        store(missing_inputs[lane], std::move(missing_outputs[lane]));
+    }
+    for (auto &entry: waiting) {
+        outputs[entry.first] = results.at(missing_inputs[entry.second]);
+    }
+    return outputs;
+}
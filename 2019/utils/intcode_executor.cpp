@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <utility>
+
+#include "intcode.h"
+
+
+// The executor and worker running on this thread, if any,
+// so that machines sent input from a handler stay on that worker
+thread_local const IntcodeExecutor *current_executor = nullptr;
+thread_local size_t current_worker = 0;
+
+
+IntcodeExecutor::IntcodeExecutor(size_t num_workers):
+        deques(std::max(num_workers, size_t{1})) {}
+
+
+size_t IntcodeExecutor::add_machine(IntcodeMachine machine) {
+    auto id = slots.size();
+    slots.push_back(std::make_unique<Slot>(std::move(machine)));
+    ++pending;
+    push(id % deques.size(), id);
+    return id;
+}
+
+
+void IntcodeExecutor::send(size_t id, std::initializer_list<intcode_type> values) {
+    auto &slot = *slots.at(id);
+    {
+        std::lock_guard<std::mutex> guard(slot.mutex);
+        slot.inbox.insert(slot.inbox.end(), values);
+        if (slot.scheduled) {
+            // It'll pick up the new values when it next runs
+            return;
+        }
+        slot.scheduled = true;
+    }
+    ++pending;
+    push(current_executor == this ? current_worker : id % deques.size(), id);
+}
+
+
+void IntcodeExecutor::run(const OutputHandler &handler, const StopToken &stop_token) {
+    if (pending == 0) {
+        return;
+    }
+    for (auto &slot: slots) {
+        slot->machine.set_stop_token(stop_token);
+    }
+    done = false;
+    std::vector<std::thread> workers;
+    for (size_t worker = 0; worker < deques.size(); ++worker) {
+        workers.emplace_back([this, worker, &handler, &stop_token]() -> void {
+            work(worker, handler, stop_token);
+        });
+    }
+    for (auto &thd: workers) {
+        thd.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+
+void IntcodeExecutor::work(size_t worker, const OutputHandler &handler,
+                           const StopToken &stop_token) {
+    current_executor = this;
+    current_worker = worker;
+    while (!done) {
+        if (stop_token.stop_requested()) {
+            // Wake the others, which may be asleep waiting for work
+            finish();
+            break;
+        }
+        size_t id;
+        if (pop(worker, id) || steal(worker, id)) {
+            run_slice(worker, id, handler);
+        } else if (!wait_for_work()) {
+            break;
+        }
+    }
+    current_executor = nullptr;
+}
+
+
+void IntcodeExecutor::run_slice(size_t worker, size_t id, const OutputHandler &handler) {
+    auto &slot = *slots[id];
+    try {
+        {
+            std::lock_guard<std::mutex> guard(slot.mutex);
+            for (auto value: slot.inbox) {
+                slot.machine.feed(value);
+            }
+            slot.inbox.clear();
+        }
+        slot.machine.run_until_input_needed();
+        ++slices;
+        auto outputs = slot.machine.take_outputs();
+        if (!outputs.empty()) {
+            handler(id, outputs);
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> guard(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        finish();
+        return;
+    }
+
+    bool runnable;
+    {
+        std::lock_guard<std::mutex> guard(slot.mutex);
+        runnable = !slot.inbox.empty()
+                   && slot.machine.get_state() != IntcodeMachine::State::HALTED;
+        slot.scheduled = runnable;
+    }
+    if (runnable) {
+        // Values arrived while it was running
+        push(worker, id);
+    } else if (--pending == 0) {
+        // Handlers only send while their own machine is scheduled,
+        // so once nothing is, nothing ever will be again
+        finish();
+    }
+}
+
+
+void IntcodeExecutor::push(size_t worker, size_t id) {
+    {
+        auto &deque = deques[worker];
+        std::lock_guard<std::mutex> guard(deque.mutex);
+        deque.ids.push_back(id);
+        ++queued;
+    }
+    // A worker about to sleep increments sleeping before checking queued,
+    // so either it sees this machine or this sees it and wakes it
+    if (sleeping > 0) {
+        std::lock_guard<std::mutex> guard(idle_mutex);
+        work_added.notify_one();
+    }
+}
+
+
+bool IntcodeExecutor::pop(size_t worker, size_t &id) {
+    auto &deque = deques[worker];
+    std::lock_guard<std::mutex> guard(deque.mutex);
+    if (deque.ids.empty()) {
+        return false;
+    }
+    // Newest first, since its inputs are most likely still in cache
+    id = deque.ids.back();
+    deque.ids.pop_back();
+    --queued;
+    return true;
+}
+
+
+bool IntcodeExecutor::steal(size_t worker, size_t &id) {
+    for (size_t offset = 1; offset < deques.size(); ++offset) {
+        auto &deque = deques[(worker + offset) % deques.size()];
+        std::lock_guard<std::mutex> guard(deque.mutex);
+        if (!deque.ids.empty()) {
+            id = deque.ids.front();
+            deque.ids.pop_front();
+            --queued;
+            ++steals;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool IntcodeExecutor::wait_for_work() {
+    std::unique_lock<std::mutex> lock(idle_mutex);
+    ++sleeping;
+    work_added.wait(lock, [this]() -> bool {
+        return queued > 0 || done;
+    });
+    --sleeping;
+    return !done;
+}
+
+
+void IntcodeExecutor::finish() {
+    std::lock_guard<std::mutex> guard(idle_mutex);
+    done = true;
+    work_added.notify_all();
+}
@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "intcode.h"
+
+
+// See save_intcode_image() for the layout
+constexpr char IMAGE_MAGIC[8] = "ICIMAGE";
+constexpr std::uint32_t IMAGE_VERSION = 1;
+constexpr std::uint32_t FLAG_HANDLERS = 1;
+constexpr size_t HEADER_SIZE = 24;
+constexpr size_t CELL_SIZE = 8;
+constexpr size_t HANDLER_SIZE = 2;
+// Program memory can't be backed by more cells than this
+constexpr std::uint64_t MAX_IMAGE_CELLS = IntcodeMemory::MAX_PAGES * IntcodeMemory::PAGE_SIZE;
+
+
+struct ImageHeader {
+    std::uint32_t flags;
+    std::uint64_t num_cells;
+};
+
+
+bool host_is_little_endian() {
+    const std::uint16_t probe = 1;
+    unsigned char first_byte;
+    std::memcpy(&first_byte, &probe, 1);
+    return first_byte == 1;
+}
+
+
+void write_little_endian(std::ostream &output, std::uint64_t value, size_t num_bytes) {
+    for (size_t i = 0; i < num_bytes; ++i) {
+        output.put(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+
+std::uint64_t read_little_endian(const unsigned char *bytes, size_t num_bytes) {
+    std::uint64_t value = 0;
+    for (size_t i = 0; i < num_bytes; ++i) {
+        value |= static_cast<std::uint64_t>(bytes[i]) << (8 * i);
+    }
+    return value;
+}
+
+
+// Check the header at the start of an image, which has size bytes in total
+ImageHeader parse_header(const unsigned char *bytes, size_t size,
+                         const std::string &source) {
+    if (size < HEADER_SIZE || std::memcmp(bytes, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0) {
+        std::stringstream error_message;
+        error_message << "Not an Intcode image: " << source;
+        throw std::runtime_error(error_message.str());
+    }
+    auto version = read_little_endian(bytes + 8, 4);
+    if (version != IMAGE_VERSION) {
+        std::stringstream error_message;
+        error_message << "Unsupported Intcode image version " << version;
+        error_message << " in " << source;
+        throw std::runtime_error(error_message.str());
+    }
+    ImageHeader header{static_cast<std::uint32_t>(read_little_endian(bytes + 12, 4)),
+                       read_little_endian(bytes + 16, 8)};
+    if (header.num_cells > MAX_IMAGE_CELLS) {
+        std::stringstream error_message;
+        error_message << "Intcode image has too many cells (" << header.num_cells;
+        error_message << "): " << source;
+        throw std::runtime_error(error_message.str());
+    }
+    auto cell_size = CELL_SIZE + (header.flags & FLAG_HANDLERS ? HANDLER_SIZE : 0);
+    if (header.num_cells > (size - HEADER_SIZE) / cell_size) {
+        std::stringstream error_message;
+        error_message << "Truncated Intcode image: " << source;
+        throw std::runtime_error(error_message.str());
+    }
+    return header;
+}
+
+
+void save_intcode_image(const program_type &program, size_t num_cells,
+                        std::ostream &output, bool include_handlers) {
+    output.write(IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    write_little_endian(output, IMAGE_VERSION, 4);
+    write_little_endian(output, include_handlers ? FLAG_HANDLERS : 0, 4);
+    write_little_endian(output, num_cells, 8);
+    for (size_t address = 0; address < num_cells; ++address) {
+        write_little_endian(output, static_cast<std::uint64_t>(program.read(address)), CELL_SIZE);
+    }
+    if (include_handlers) {
+        for (size_t address = 0; address < num_cells; ++address) {
+            std::uint16_t handler = 0;
+            try {
+                handler = decode_instruction(program.read(address)).handler;
+            } catch (const std::invalid_argument &) {
+                // Data rather than an instruction
+            }
+            write_little_endian(output, handler, HANDLER_SIZE);
+        }
+    }
+}
+
+
+// Files smaller than this are read rather than mapped. An image this
+// small has less than a page of cells, which memory would copy anyway.
+constexpr size_t MIN_MAPPED_SIZE =
+    HEADER_SIZE + IntcodeMemory::PAGE_SIZE * (CELL_SIZE + HANDLER_SIZE);
+
+
+// The whole contents of a file, which has size bytes. The result is
+// aligned for intcode_type, and stays valid for as long as it's held.
+std::shared_ptr<const unsigned char> read_file(const std::string &filename, size_t &size) {
+    auto file = open(filename.c_str(), O_RDONLY);
+    if (file < 0) {
+        std::stringstream error_message;
+        error_message << "File not found: " << filename;
+        throw std::runtime_error(error_message.str());
+    }
+    struct stat info;
+    if (fstat(file, &info) != 0) {
+        close(file);
+        std::stringstream error_message;
+        error_message << "Couldn't read " << filename;
+        throw std::runtime_error(error_message.str());
+    }
+    size = static_cast<size_t>(info.st_size);
+
+    if (size < MIN_MAPPED_SIZE) {
+        auto buffer = std::make_shared<std::vector<intcode_type> >(
+            (size + sizeof(intcode_type) - 1) / sizeof(intcode_type));
+        auto bytes = reinterpret_cast<unsigned char *>(buffer->data());
+        size_t total = 0;
+        while (total < size) {
+            auto count = read(file, bytes + total, size - total);
+            if (count <= 0) {
+                break;
+            }
+            total += static_cast<size_t>(count);
+        }
+        close(file);
+        // The file may have shrunk since fstat()
+        size = total;
+        return std::shared_ptr<const unsigned char>(buffer, bytes);
+    }
+
+    auto address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+    // The mapping stays valid after the file is closed
+    close(file);
+    if (address == MAP_FAILED) {
+        std::stringstream error_message;
+        error_message << "Couldn't map " << filename;
+        throw std::runtime_error(error_message.str());
+    }
+    auto mapped_size = size;
+    return std::shared_ptr<const unsigned char>(
+        static_cast<const unsigned char *>(address),
+        [mapped_size](const unsigned char *bytes) -> void {
+            munmap(const_cast<unsigned char *>(bytes), mapped_size);
+        });
+}
+
+
+// An image backed by bytes, which hold size bytes in total
+IntcodeImage image_from_bytes(const std::shared_ptr<const unsigned char> &bytes,
+                              size_t size, const std::string &source) {
+    auto header = parse_header(bytes.get(), size, source);
+    auto num_cells = static_cast<size_t>(header.num_cells);
+    auto cells = bytes.get() + HEADER_SIZE;
+    auto handlers = cells + num_cells * CELL_SIZE;
+    IntcodeImage image{program_type(), num_cells, nullptr};
+    if (host_is_little_endian()) {
+        // Both tables are suitably aligned, since the bytes are aligned
+        // for cells and the header size is a multiple of 8
+        image.program = IntcodeMemory::from_storage(
+            std::shared_ptr<const intcode_type>(
+                bytes, reinterpret_cast<const intcode_type *>(cells)),
+            num_cells);
+        if (header.flags & FLAG_HANDLERS) {
+            image.handlers = std::shared_ptr<const std::uint16_t>(
+                bytes, reinterpret_cast<const std::uint16_t *>(handlers));
+        }
+    } else {
+        auto values = std::make_shared<std::vector<intcode_type> >(num_cells);
+        for (size_t i = 0; i < num_cells; ++i) {
+            (*values)[i] = static_cast<intcode_type>(
+                read_little_endian(cells + i * CELL_SIZE, CELL_SIZE));
+        }
+        image.program = IntcodeMemory::from_storage(
+            std::shared_ptr<const intcode_type>(values, values->data()), num_cells);
+        if (header.flags & FLAG_HANDLERS) {
+            auto indices = std::make_shared<std::vector<std::uint16_t> >(num_cells);
+            for (size_t i = 0; i < num_cells; ++i) {
+                (*indices)[i] = static_cast<std::uint16_t>(
+                    read_little_endian(handlers + i * HANDLER_SIZE, HANDLER_SIZE));
+            }
+            image.handlers = std::shared_ptr<const std::uint16_t>(indices, indices->data());
+        }
+    }
+    // The decoded instruction table isn't checked here, since that would
+    // mean decoding every cell. IntcodeMachine checks each entry instead,
+    // the first time it's used.
+    return image;
+}
+
+
+IntcodeImage load_intcode_image(const std::string &filename) {
+    size_t size = 0;
+    auto bytes = read_file(filename, size);
+    return image_from_bytes(bytes, size, filename);
+}
+
+
+program_type load_intcode_program(const std::string &filename) {
+    size_t size = 0;
+    auto bytes = read_file(filename, size);
+    if (size >= sizeof(IMAGE_MAGIC)
+            && std::memcmp(bytes.get(), IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0) {
+        return image_from_bytes(bytes, size, filename).program;
+    }
+    return parse_intcode_program(reinterpret_cast<const char *>(bytes.get()), size);
+}
+
+
+bool is_intcode_image(std::istream &input_stream) {
+    return input_stream.peek() == IMAGE_MAGIC[0];
+}
+
+
+program_type read_intcode_image(std::istream &input_stream) {
+    unsigned char header_bytes[HEADER_SIZE];
+    input_stream.read(reinterpret_cast<char *>(header_bytes), HEADER_SIZE);
+    // The stream's length isn't known up front, so assume the cells the
+    // header declares are present and check as they're read instead
+    auto available = static_cast<size_t>(input_stream.gcount());
+    if (available == HEADER_SIZE) {
+        available = std::numeric_limits<size_t>::max();
+    }
+    auto header = parse_header(header_bytes, available, "input stream");
+    auto num_cells = static_cast<size_t>(header.num_cells);
+    // Grow a page at a time as cells arrive, so a bad header can't
+    // allocate much up front
+    auto values = std::make_shared<std::vector<intcode_type> >();
+    std::vector<unsigned char> cell_bytes;
+    while (values->size() < num_cells) {
+        auto count = std::min(num_cells - values->size(), IntcodeMemory::PAGE_SIZE);
+        cell_bytes.resize(count * CELL_SIZE);
+        if (!input_stream.read(reinterpret_cast<char *>(cell_bytes.data()),
+                               static_cast<std::streamsize>(cell_bytes.size()))) {
+            throw std::runtime_error("Truncated Intcode image: input stream");
+        }
+        auto first = values->size();
+        values->resize(first + count);
+        if (host_is_little_endian()) {
+            std::memcpy(values->data() + first, cell_bytes.data(), cell_bytes.size());
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                (*values)[first + i] = static_cast<intcode_type>(
+                    read_little_endian(cell_bytes.data() + i * CELL_SIZE, CELL_SIZE));
+            }
+        }
+    }
+    return IntcodeMemory::from_storage(
+        std::shared_ptr<const intcode_type>(values, values->data()), num_cells);
+}
@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "intcode.h"
+
+
+std::string instruction_name(const IntcodeInstruction &instruction) {
+    std::string name;
+    switch (instruction.opcode) {
+        case Opcode::ADD:
+            name = "ADD";
+            break;
+        case Opcode::MULTIPLY:
+            name = "MULTIPLY";
+            break;
+        case Opcode::INPUT:
+            name = "INPUT";
+            break;
+        case Opcode::OUTPUT:
+            name = "OUTPUT";
+            break;
+        case Opcode::JUMP_TRUE:
+            name = "JUMP_TRUE";
+            break;
+        case Opcode::JUMP_FALSE:
+            name = "JUMP_FALSE";
+            break;
+        case Opcode::LESS_THAN:
+            name = "LESS_THAN";
+            break;
+        case Opcode::EQUALS:
+            name = "EQUALS";
+            break;
+        case Opcode::REL_BASE:
+            name = "REL_BASE";
+            break;
+        case Opcode::END:
+            return "END";
+    }
+    // One letter per operand: Positional, Immediate or Relative
+    name += ' ';
+    for (auto i = 0; i < num_operands(instruction.opcode); ++i) {
+        name += "PIR"[static_cast<int>(instruction.modes[i])];
+    }
+    return name;
+}
+
+
+// Indices of the nonzero counts, highest count first
+template <typename Counts>
+std::vector<size_t> rank_counts(const Counts &counts, size_t max_rows) {
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        if (counts[i] > 0) {
+            indices.push_back(i);
+        }
+    }
+    auto num_rows = std::min(max_rows, indices.size());
+    std::partial_sort(indices.begin(), indices.begin() + num_rows, indices.end(),
+                      [&counts](size_t a, size_t b) -> bool {
+                          return counts[a] != counts[b] ? counts[a] > counts[b] : a < b;
+                      });
+    indices.resize(num_rows);
+    return indices;
+}
+
+
+std::uint64_t IntcodeProfile::total_instructions() const {
+    return std::accumulate(handler_counts.begin(), handler_counts.end(), std::uint64_t{0});
+}
+
+
+void IntcodeProfile::report(std::ostream &output, size_t max_rows) const {
+    auto total = total_instructions();
+    auto percent = [total](std::uint64_t count) -> double {
+        return total > 0 ? 100.0 * count / total : 0.0;
+    };
+    output << "Instructions executed: " << total << std::endl;
+    output << "Inputs: " << inputs << ", outputs: " << outputs << std::endl;
+    output << "Highest address written: " << highest_write << std::endl;
+    output << "Paged memory allocated: " << allocated_cells << " cells" << std::endl;
+
+    output << std::endl << "Hottest addresses:" << std::endl;
+    output << std::setw(10) << "address" << std::setw(14) << "count";
+    output << std::setw(9) << "%" << "  instruction" << std::endl;
+    for (auto address: rank_counts(address_counts, max_rows)) {
+        auto count = address_counts[address];
+        output << std::setw(10) << address << std::setw(14) << count;
+        output << std::setw(9) << std::fixed << std::setprecision(2) << percent(count);
+        output << std::defaultfloat << "  ";
+        output << instruction_name(handler_instruction(address_handlers[address]));
+        output << std::endl;
+    }
+    if (far_instructions > 0) {
+        output << std::setw(10) << "far" << std::setw(14) << far_instructions << std::endl;
+    }
+
+    output << std::endl << "Opcode and mode combinations:" << std::endl;
+    output << std::setw(14) << "count" << std::setw(9) << "%" << "  instruction" << std::endl;
+    for (auto handler: rank_counts(handler_counts, max_rows)) {
+        auto count = handler_counts[handler];
+        output << std::setw(14) << count;
+        output << std::setw(9) << std::fixed << std::setprecision(2) << percent(count);
+        output << std::defaultfloat << "  ";
+        output << instruction_name(handler_instruction(static_cast<std::uint16_t>(handler)));
+        output << std::endl;
+    }
+}
@@ -0,0 +1,253 @@
+#include <array>
+#include <sstream>
+#include <stdexcept>
+
+#include "intcode.h"
+
+
+#if INTCODE_HAS_COMPUTED_GOTO
+
+// Operand access for each mode, relative to the current instruction
+#define LOAD_POSITIONAL(n) memory.read(memory.read(pc + (n)))
+#define LOAD_IMMEDIATE(n) memory.read(pc + (n))
+#define LOAD_RELATIVE(n) memory.read(relative_base + memory.read(pc + (n)))
+#define ADDRESS_POSITIONAL(n) memory.read(pc + (n))
+#define ADDRESS_RELATIVE(n) (relative_base + memory.read(pc + (n)))
+
+#define APPLY_ADD(a, b) ((a) + (b))
+#define APPLY_MULTIPLY(a, b) ((a) * (b))
+#define APPLY_LESS_THAN(a, b) ((a) < (b) ? 1 : 0)
+#define APPLY_EQUALS(a, b) ((a) == (b) ? 1 : 0)
+#define CONDITION_JUMP_TRUE(a) ((a) != 0)
+#define CONDITION_JUMP_FALSE(a) ((a) == 0)
+
+// Valid mode combinations for each kind of instruction.
+// Unused operands are always POSITIONAL.
+#define READ_MODES_1(X, OP) \
+    X(OP, POSITIONAL, POSITIONAL, POSITIONAL) \
+    X(OP, IMMEDIATE, POSITIONAL, POSITIONAL) \
+    X(OP, RELATIVE, POSITIONAL, POSITIONAL)
+
+#define WRITE_MODES_1(X, OP) \
+    X(OP, POSITIONAL, POSITIONAL, POSITIONAL) \
+    X(OP, RELATIVE, POSITIONAL, POSITIONAL)
+
+#define READ_MODES_2(X, OP) \
+    X(OP, POSITIONAL, POSITIONAL, POSITIONAL) \
+    X(OP, POSITIONAL, IMMEDIATE, POSITIONAL) \
+    X(OP, POSITIONAL, RELATIVE, POSITIONAL) \
+    X(OP, IMMEDIATE, POSITIONAL, POSITIONAL) \
+    X(OP, IMMEDIATE, IMMEDIATE, POSITIONAL) \
+    X(OP, IMMEDIATE, RELATIVE, POSITIONAL) \
+    X(OP, RELATIVE, POSITIONAL, POSITIONAL) \
+    X(OP, RELATIVE, IMMEDIATE, POSITIONAL) \
+    X(OP, RELATIVE, RELATIVE, POSITIONAL)
+
+#define READ_MODES_2_WRITE_MODES_1(X, OP) \
+    X(OP, POSITIONAL, POSITIONAL, POSITIONAL) \
+    X(OP, POSITIONAL, IMMEDIATE, POSITIONAL) \
+    X(OP, POSITIONAL, RELATIVE, POSITIONAL) \
+    X(OP, IMMEDIATE, POSITIONAL, POSITIONAL) \
+    X(OP, IMMEDIATE, IMMEDIATE, POSITIONAL) \
+    X(OP, IMMEDIATE, RELATIVE, POSITIONAL) \
+    X(OP, RELATIVE, POSITIONAL, POSITIONAL) \
+    X(OP, RELATIVE, IMMEDIATE, POSITIONAL) \
+    X(OP, RELATIVE, RELATIVE, POSITIONAL) \
+    X(OP, POSITIONAL, POSITIONAL, RELATIVE) \
+    X(OP, POSITIONAL, IMMEDIATE, RELATIVE) \
+    X(OP, POSITIONAL, RELATIVE, RELATIVE) \
+    X(OP, IMMEDIATE, POSITIONAL, RELATIVE) \
+    X(OP, IMMEDIATE, IMMEDIATE, RELATIVE) \
+    X(OP, IMMEDIATE, RELATIVE, RELATIVE) \
+    X(OP, RELATIVE, POSITIONAL, RELATIVE) \
+    X(OP, RELATIVE, IMMEDIATE, RELATIVE) \
+    X(OP, RELATIVE, RELATIVE, RELATIVE)
+
+#define HANDLER_LABEL(OP, A, B, C) OP##_##A##_##B##_##C
+
+#define REGISTER_HANDLER(OP, A, B, C) \
+    table[handler_index(Opcode::OP, {Mode::A, Mode::B, Mode::C})] = \
+        &&HANDLER_LABEL(OP, A, B, C);
+
+// Superinstructions, see compare_branch_index() and rel_base_jump_index()
+#define COMPARE_BRANCH_LABEL(OP, JUMP, A, B, C) OP##_##JUMP##_##A##_##B##_##C
+#define REL_BASE_JUMP_LABEL(OP, A, B, C) REL_BASE_##OP##_##A##_##B
+
+#define REGISTER_COMPARE_BRANCH_HANDLER(OP, JUMP, A, B, C) \
+    table[compare_branch_index(Opcode::OP, Opcode::JUMP, {Mode::A, Mode::B, Mode::C})] = \
+        &&COMPARE_BRANCH_LABEL(OP, JUMP, A, B, C);
+#define REGISTER_COMPARE_JUMP_TRUE_HANDLER(OP, A, B, C) \
+    REGISTER_COMPARE_BRANCH_HANDLER(OP, JUMP_TRUE, A, B, C)
+#define REGISTER_COMPARE_JUMP_FALSE_HANDLER(OP, A, B, C) \
+    REGISTER_COMPARE_BRANCH_HANDLER(OP, JUMP_FALSE, A, B, C)
+
+#define REGISTER_REL_BASE_JUMP_HANDLER(OP, A, B, C) \
+    table[rel_base_jump_index(Opcode::OP, Mode::A, Mode::B)] = \
+        &&REL_BASE_JUMP_LABEL(OP, A, B, C);
+
+#ifdef INTCODE_COUNT_DISPATCHES
+#define COUNT_DISPATCH() ++dispatches
+#else
+#define COUNT_DISPATCH()
+#endif
+
+// Jump to the handler for the instruction at pc,
+// decoding it first if it isn't in the cache
+#define DISPATCH() \
+    do { \
+        COUNT_DISPATCH(); \
+        if (static_cast<size_t>(pc) < code.instructions.size()) { \
+            goto *handlers[code.instructions[pc].handler]; \
+        } \
+        goto decode; \
+    } while (0)
+
+// Write the registers back to the machine and pause
+#define SUSPEND(new_state) \
+    do { \
+        this->pc = pc; \
+        this->relative_base = relative_base; \
+        state = (new_state); \
+        return state; \
+    } while (0)
+
+#define ARITHMETIC_HANDLER(OP, A, B, C) \
+    HANDLER_LABEL(OP, A, B, C): \
+        write(ADDRESS_##C(3), APPLY_##OP(LOAD_##A(1), LOAD_##B(2))); \
+        pc += 4; \
+        DISPATCH();
+
+#define JUMP_HANDLER(OP, A, B, C) \
+    HANDLER_LABEL(OP, A, B, C): \
+        if (stop_token.stop_requested()) { \
+            SUSPEND(State::STOPPED); \
+        } \
+        pc = CONDITION_##OP(LOAD_##A(1)) ? LOAD_##B(2) : pc + 3; \
+        note_block_entry(pc); \
+        DISPATCH();
+
+#define INPUT_HANDLER(OP, A, B, C) \
+    HANDLER_LABEL(OP, A, B, C): \
+        if (stop_token.stop_requested()) { \
+            SUSPEND(State::STOPPED); \
+        } \
+        if (inputs.empty()) { \
+            SUSPEND(State::NEEDS_INPUT); \
+        } \
+        write(ADDRESS_##A(1), inputs.front()); \
+        inputs.pop_front(); \
+        pc += 2; \
+        DISPATCH();
+
+#define OUTPUT_HANDLER(OP, A, B, C) \
+    HANDLER_LABEL(OP, A, B, C): \
+        outputs.push_back(LOAD_##A(1)); \
+        pc += 2; \
+        if (stop_on_output) { \
+            SUSPEND(State::HAS_OUTPUT); \
+        } \
+        DISPATCH();
+
+#define REL_BASE_HANDLER(OP, A, B, C) \
+    HANDLER_LABEL(OP, A, B, C): \
+        relative_base += LOAD_##A(1); \
+        pc += 2; \
+        DISPATCH();
+
+// The comparison's result is the jump's condition,
+// so it doesn't need to be read back from memory
+#define COMPARE_BRANCH_HANDLER(OP, JUMP, A, B, C) \
+    COMPARE_BRANCH_LABEL(OP, JUMP, A, B, C): { \
+        auto result = APPLY_##OP(LOAD_##A(1), LOAD_##B(2)); \
+        write(ADDRESS_##C(3), result); \
+        pc += 4; \
+        if (!code.instructions[pc - 4].is_fused()) { \
+            /* The write modified the jump, so run it separately */ \
+            DISPATCH(); \
+        } \
+        if (stop_token.stop_requested()) { \
+            SUSPEND(State::STOPPED); \
+        } \
+        pc = CONDITION_##JUMP(result) ? LOAD_IMMEDIATE(2) : pc + 3; \
+        note_block_entry(pc); \
+        DISPATCH(); \
+    }
+#define COMPARE_JUMP_TRUE_HANDLER(OP, A, B, C) \
+    COMPARE_BRANCH_HANDLER(OP, JUMP_TRUE, A, B, C)
+#define COMPARE_JUMP_FALSE_HANDLER(OP, A, B, C) \
+    COMPARE_BRANCH_HANDLER(OP, JUMP_FALSE, A, B, C)
+
+// REL_BASE can't modify code, so go straight to the jump's handler
+#define REL_BASE_JUMP_HANDLER(OP, A, B, C) \
+    REL_BASE_JUMP_LABEL(OP, A, B, C): \
+        relative_base += LOAD_IMMEDIATE(1); \
+        pc += 2; \
+        goto HANDLER_LABEL(OP, A, B, C);
+
+
+IntcodeMachine::State IntcodeMachine::run_threaded(bool stop_on_output) {
+    // Label addresses only exist inside this function, so the table is
+    // filled in here, once, by the first call. Statement expressions are
+    // another GCC extension, available wherever computed goto is.
+    // Combinations without a handler are invalid.
+    static const std::array<const void *, NUM_HANDLER_INDICES> handlers = ({
+        std::array<const void *, NUM_HANDLER_INDICES> table;
+        table.fill(&&invalid);
+        table[0] = &&decode;
+        READ_MODES_2_WRITE_MODES_1(REGISTER_HANDLER, ADD)
+        READ_MODES_2_WRITE_MODES_1(REGISTER_HANDLER, MULTIPLY)
+        READ_MODES_2_WRITE_MODES_1(REGISTER_HANDLER, LESS_THAN)
+        READ_MODES_2_WRITE_MODES_1(REGISTER_HANDLER, EQUALS)
+        READ_MODES_2(REGISTER_HANDLER, JUMP_TRUE)
+        READ_MODES_2(REGISTER_HANDLER, JUMP_FALSE)
+        WRITE_MODES_1(REGISTER_HANDLER, INPUT)
+        READ_MODES_1(REGISTER_HANDLER, OUTPUT)
+        READ_MODES_1(REGISTER_HANDLER, REL_BASE)
+        REGISTER_HANDLER(END, POSITIONAL, POSITIONAL, POSITIONAL)
+        READ_MODES_2_WRITE_MODES_1(REGISTER_COMPARE_JUMP_TRUE_HANDLER, LESS_THAN)
+        READ_MODES_2_WRITE_MODES_1(REGISTER_COMPARE_JUMP_FALSE_HANDLER, LESS_THAN)
+        READ_MODES_2_WRITE_MODES_1(REGISTER_COMPARE_JUMP_TRUE_HANDLER, EQUALS)
+        READ_MODES_2_WRITE_MODES_1(REGISTER_COMPARE_JUMP_FALSE_HANDLER, EQUALS)
+        READ_MODES_2(REGISTER_REL_BASE_JUMP_HANDLER, JUMP_TRUE)
+        READ_MODES_2(REGISTER_REL_BASE_JUMP_HANDLER, JUMP_FALSE)
+        table;
+    });
+
+    // Keep the registers in locals (shadowing the members) so the compiler
+    // doesn't have to assume every memory write might modify them
+    auto pc = this->pc;
+    auto relative_base = this->relative_base;
+    DISPATCH();
+
+decode:
+    goto *handlers[fetch(pc).handler];
+
+invalid: {
+    auto instruction = decode_instruction(memory.read(pc));
+    std::stringstream error_message;
+    error_message << "Opcode " << static_cast<int>(instruction.opcode);
+    error_message << " doesn't accept modes " << memory.read(pc) / 100;
+    throw std::logic_error(error_message.str());
+}
+
+    READ_MODES_2_WRITE_MODES_1(ARITHMETIC_HANDLER, ADD)
+    READ_MODES_2_WRITE_MODES_1(ARITHMETIC_HANDLER, MULTIPLY)
+    READ_MODES_2_WRITE_MODES_1(ARITHMETIC_HANDLER, LESS_THAN)
+    READ_MODES_2_WRITE_MODES_1(ARITHMETIC_HANDLER, EQUALS)
+    READ_MODES_2(JUMP_HANDLER, JUMP_TRUE)
+    READ_MODES_2(JUMP_HANDLER, JUMP_FALSE)
+    WRITE_MODES_1(INPUT_HANDLER, INPUT)
+    READ_MODES_1(OUTPUT_HANDLER, OUTPUT)
+    READ_MODES_1(REL_BASE_HANDLER, REL_BASE)
+    READ_MODES_2_WRITE_MODES_1(COMPARE_JUMP_TRUE_HANDLER, LESS_THAN)
+    READ_MODES_2_WRITE_MODES_1(COMPARE_JUMP_FALSE_HANDLER, LESS_THAN)
+    READ_MODES_2_WRITE_MODES_1(COMPARE_JUMP_TRUE_HANDLER, EQUALS)
+    READ_MODES_2_WRITE_MODES_1(COMPARE_JUMP_FALSE_HANDLER, EQUALS)
+    READ_MODES_2(REL_BASE_JUMP_HANDLER, JUMP_TRUE)
+    READ_MODES_2(REL_BASE_JUMP_HANDLER, JUMP_FALSE)
+
+HANDLER_LABEL(END, POSITIONAL, POSITIONAL, POSITIONAL):
+    SUSPEND(State::HALTED);
+}
+
+#endif
@@ -6,18 +6,23 @@
 
 
 std::ifstream open_input_file(int argc, char **argv) {
-    if (argc != 2) {
+    auto filename = input_filename(argc, argv);
+    std::ifstream input_stream(filename);
+    if (!input_stream) {
         std::stringstream error_message;
-        error_message << "Usage: " << argv[0] << " input.txt";
+        error_message << "File not found: " << filename;
         throw std::runtime_error(error_message.str());
     }
 
-    std::ifstream input_stream(argv[1]);
-    if (!input_stream) {
+    return input_stream;
+}
+
+
+std::string input_filename(int argc, char **argv) {
+    if (argc != 2) {
         std::stringstream error_message;
-        error_message << "File not found: " << argv[1];
+        error_message << "Usage: " << argv[0] << " input.txt";
         throw std::runtime_error(error_message.str());
     }
-
-    return input_stream;
+    return argv[1];
 }
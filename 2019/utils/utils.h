@@ -1,19 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <exception>
 #include <fstream>
+#include <initializer_list>
 #include <iterator>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <deque>
+#include <string>
 #include <thread>
 #include <utility>
 #include <vector>
 
 
 std::ifstream open_input_file(int argc, char **argv);
+// The input filename, after the same usage check as open_input_file()
+std::string input_filename(int argc, char **argv);
+
+
+// Shared flag used to ask running work to stop early. Copies refer to
+// the same flag, so one token can be handed to worker threads and
+// callbacks alike.
+class StopToken {
+public:
+    StopToken(): flag(std::make_shared<std::atomic<bool> >(false)) {}
+
+    void request_stop() {
+        flag->store(true, std::memory_order_relaxed);
+    }
+
+    bool stop_requested() const {
+        return flag->load(std::memory_order_relaxed);
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool> > flag;
+};
+
+
+// Call func(i) for each i in [0, count), spreading the calls across
+// a fixed pool of worker threads sized to the hardware concurrency.
+// The first exception thrown by any call is rethrown once all workers finish.
+// Once stop_token is triggered, workers start no new calls, so some
+// indices may never be visited. Calls already under way are left to finish.
+template <typename Func>
+void parallel_for(size_t count, Func func, const StopToken &stop_token) {
+    size_t num_workers = std::max(1u, std::thread::hardware_concurrency());
+    num_workers = std::min(num_workers, count);
+
+    std::atomic<size_t> next_index{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]() -> void {
+        for (auto i = next_index++; i < count && !stop_token.stop_requested(); i = next_index++) {
+            try {
+                func(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < num_workers; ++i) {
+        workers.emplace_back(worker);
+    }
+    for (auto &thd: workers) {
+        thd.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+
+template <typename Func>
+void parallel_for(size_t count, Func func) {
+    parallel_for(count, std::move(func), StopToken());
+}
 
 
 // A class that contains multiple queues,
 // all protected by a single mutex.
+// Each queue has its own condition variable,
+// so blocked consumers wake as soon as data is pushed to their queue.
 template <typename T>
 class MultiQueue {
 public:
@@ -21,8 +99,9 @@ public:
         std::lock_guard<std::mutex> guard(top_level_mutex);
         auto& que = queues[queue_num];
         for (auto &val: values) {
-            que.push_back(val);
+            que.items.push_back(val);
         }
+        que.items_added.notify_all();
     }
 
     void push_queue(size_t queue_num, const T &value) {
@@ -33,22 +112,27 @@ public:
     std::vector<T> pop_queue_multiple_blocking(size_t queue_num, size_t num_values) {
         std::unique_lock<std::mutex> lock(top_level_mutex);
         auto& que = queues[queue_num];
-        // Wait for items to be added to the queue
-        while (true) {
-            if (que.size() >= num_values) {
-                // Don't unlock mutex here
-                break;
-            }
-            lock.unlock();
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            lock.lock();
+        que.items_added.wait(lock, [&que, num_values]() -> bool {
+            return que.items.size() >= num_values;
+        });
+        return pop_front(que, num_values);
+    }
+
+    // Like pop_queue_multiple_blocking, but give up after the given timeout.
+    // Returns an empty vector if the items didn't arrive in time.
+    template <typename Rep, typename Period>
+    std::vector<T> pop_queue_multiple_blocking_for(
+            size_t queue_num, size_t num_values,
+            const std::chrono::duration<Rep, Period> &timeout) {
+        std::unique_lock<std::mutex> lock(top_level_mutex);
+        auto& que = queues[queue_num];
+        auto available = que.items_added.wait_for(lock, timeout, [&que, num_values]() -> bool {
+            return que.items.size() >= num_values;
+        });
+        if (!available) {
+            return {};
         }
-        // mutex is still locked
-        auto start = que.begin();
-        auto stop = std::next(start, num_values);
-        std::vector<T> values(start, stop);
-        que.erase(start, stop);
-        return values;
+        return pop_front(que, num_values);
     }
 
     // Return a single item, blocking until it's available
@@ -62,9 +146,9 @@ public:
         auto result = default_value;
         std::lock_guard<std::mutex> guard(top_level_mutex);
         auto& que = queues[queue_num];
-        if (!que.empty()) {
-            result = que.front();
-            que.pop_front();
+        if (!que.items.empty()) {
+            result = que.items.front();
+            que.items.pop_front();
         }
         return result;
     }
@@ -72,10 +156,121 @@ public:
     size_t get_queue_size(size_t queue_num) {
         std::lock_guard<std::mutex> guard(top_level_mutex);
         auto& que = queues[queue_num];
-        return que.size();
+        return que.items.size();
     }
 
 private:
+    struct Queue {
+        std::deque<T> items;
+        std::condition_variable items_added;
+    };
+
+    // Must be called with the mutex locked
+    static std::vector<T> pop_front(Queue &que, size_t num_values) {
+        auto start = que.items.begin();
+        auto stop = std::next(start, num_values);
+        std::vector<T> values(start, stop);
+        que.items.erase(start, stop);
+        return values;
+    }
+
     std::mutex top_level_mutex;
-    std::map<size_t, std::deque<T> > queues;
+    std::map<size_t, Queue> queues;
+};
+
+
+// A fixed number of densely numbered queues, each with its own mutex,
+// so contention only occurs between threads using the same queue.
+// Has the same interface as MultiQueue.
+template <typename T>
+class DenseMultiQueue {
+public:
+    explicit DenseMultiQueue(size_t num_queues): queues(num_queues) {}
+
+    void push_queue(size_t queue_num, const std::initializer_list<T> &values) {
+        auto& que = queues.at(queue_num);
+        std::lock_guard<std::mutex> guard(que.mutex);
+        for (auto &val: values) {
+            que.items.push_back(val);
+        }
+        que.items_added.notify_all();
+    }
+
+    void push_queue(size_t queue_num, const T &value) {
+        return push_queue(queue_num, {value});
+    }
+
+    // Return a vector of several items, blocking until all items are available
+    std::vector<T> pop_queue_multiple_blocking(size_t queue_num, size_t num_values) {
+        auto& que = queues.at(queue_num);
+        std::unique_lock<std::mutex> lock(que.mutex);
+        que.items_added.wait(lock, [&que, num_values]() -> bool {
+            return que.items.size() >= num_values;
+        });
+        return pop_front(que, num_values);
+    }
+
+    // Like pop_queue_multiple_blocking, but give up after the given timeout.
+    // Returns an empty vector if the items didn't arrive in time.
+    template <typename Rep, typename Period>
+    std::vector<T> pop_queue_multiple_blocking_for(
+            size_t queue_num, size_t num_values,
+            const std::chrono::duration<Rep, Period> &timeout) {
+        auto& que = queues.at(queue_num);
+        std::unique_lock<std::mutex> lock(que.mutex);
+        auto available = que.items_added.wait_for(lock, timeout, [&que, num_values]() -> bool {
+            return que.items.size() >= num_values;
+        });
+        if (!available) {
+            return {};
+        }
+        return pop_front(que, num_values);
+    }
+
+    // Return a single item, blocking until it's available
+    T pop_queue_blocking(size_t queue_num) {
+        auto values = pop_queue_multiple_blocking(queue_num, 1);
+        return values[0];
+    }
+
+    // Return default_value if the queue is empty
+    T pop_queue_nonblocking(size_t queue_num, T default_value) {
+        auto result = default_value;
+        auto& que = queues.at(queue_num);
+        std::lock_guard<std::mutex> guard(que.mutex);
+        if (!que.items.empty()) {
+            result = que.items.front();
+            que.items.pop_front();
+        }
+        return result;
+    }
+
+    size_t get_queue_size(size_t queue_num) {
+        auto& que = queues.at(queue_num);
+        std::lock_guard<std::mutex> guard(que.mutex);
+        return que.items.size();
+    }
+
+    size_t num_queues() const {
+        return queues.size();
+    }
+
+private:
+    // Keep each queue on its own cache line to avoid false sharing
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        std::deque<T> items;
+        std::condition_variable items_added;
+    };
+
+    // Must be called with the queue's mutex locked
+    static std::vector<T> pop_front(Queue &que, size_t num_values) {
+        auto start = que.items.begin();
+        auto stop = std::next(start, num_values);
+        std::vector<T> values(start, stop);
+        que.items.erase(start, stop);
+        return values;
+    }
+
+    std::vector<Queue> queues;
 };